@@ -1,10 +1,29 @@
 #include <mpi.h>
 #include <omp.h>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <vector>
+#include <utility>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
 
 #include "cluster.h"
 #include "CycleTimer.h"
+#include "pool.h"
+
+#define SPEED_SMOOTHING 0.5 // Weight of the newest measurement in procSpeeds
+#define MIN_MEASURED_SECONDS 0.001 // Shorter measurements are too noisy to use
+#define MIN_NODE_SECONDS 0.00001 // Nodes measured for less than this keep their speed
+#define MIN_SPEED_SHARE 0.1 // No node's speed falls below this fraction of an equal share
+#define MIN_BLOCKS_PER_PROC 5
+#define BLOCKS_PER_NUMA_NODE 2
 
 namespace Cluster {
   // Information about the cluster
@@ -13,21 +32,179 @@ namespace Cluster {
   int threadsPerProc;
   int systemTime;
   int *procTimes;
+  double *procSpeeds;
 
   // Information about this node
   int procId;
+  int procsPerHost;
+  int hardwareThreads;
+  int cores;
+  int sockets;
+  int numaNodes;
+
+  // The cpus this node may run on, one per core first (grouped by NUMA node), then the
+  // remaining hardware threads of each core
+  static std::vector<int> cpuOrder;
+  static int hostProcId; // Index of this node amongst those sharing its machine
+
+  /** Returns the integer in a file like /sys/devices/system/cpu/cpu0/topology/core_id,
+      or -1 if it can't be read **/
+  static int readIntFile (const char *path) {
+    int value = -1;
+    FILE *file = fopen(path, "r");
+    if (file != NULL) {
+      if (fscanf(file, "%d", &value) != 1) {
+        value = -1;
+      }
+      fclose(file);
+    }
+    return value;
+  }
+
+  /** Returns the NUMA node of a cpu (the nodeN entry in its sysfs directory), or 0 **/
+  static int getNumaNode (int cpu) {
+    int node = 0;
+#ifdef __linux__
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir != NULL) {
+      struct dirent *entry;
+      while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+          break;
+        }
+      }
+      closedir(dir);
+    }
+#endif
+    return node;
+  }
+
+  /** Counts the hardware threads, cores, sockets and NUMA nodes this process may run on.
+      Falls back to treating every processor as its own core if sysfs isn't available. **/
+  static void detectTopology () {
+    hardwareThreads = omp_get_num_procs();
+    cores = hardwareThreads;
+    sockets = 1;
+    numaNodes = 1;
+#ifdef __linux__
+    cpu_set_t mask;
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+      return;
+    }
+    std::set<std::pair<int, int> > coreIds;
+    std::set<int> socketIds;
+    std::set<int> numaIds;
+    std::map<std::pair<int, int>, int> threadsSeen; // Hardware threads seen of each core
+    std::vector<std::pair<std::pair<int, int>, std::pair<int, int> > > cpus;
+    hardwareThreads = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (!CPU_ISSET(cpu, &mask)) {
+        continue;
+      }
+      char path[128];
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+      int socket = readIntFile(path);
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+      int core = readIntFile(path);
+      if (core < 0) {
+        core = cpu; // Without topology information, every cpu is a core
+      }
+      int numaNode = getNumaNode(cpu);
+      std::pair<int, int> coreId = std::make_pair(socket, core);
+      int smtIndex = threadsSeen[coreId]++;
+      hardwareThreads++;
+      coreIds.insert(coreId);
+      socketIds.insert(socket);
+      numaIds.insert(numaNode);
+      cpus.push_back(std::make_pair(std::make_pair(smtIndex, numaNode), std::make_pair(core, cpu)));
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpuOrder.clear();
+    for (size_t i = 0; i < cpus.size(); i++) {
+      cpuOrder.push_back(cpus[i].second.second);
+    }
+    cores = coreIds.size();
+    sockets = socketIds.size();
+    numaNodes = numaIds.size();
+#endif
+  }
+
+  /** Returns the value of an integer environment variable, or defaultValue if it isn't set **/
+  static int getEnvInt (const char *name, int defaultValue) {
+    const char *value = getenv(name);
+    if (value == NULL || atoi(value) < 1) {
+      return defaultValue;
+    }
+    return atoi(value);
+  }
+
+  /** Picks threadsPerProc and blocksPerProc from the hardware. They can be overridden with
+      the LAMBDA_THREADS_PER_PROC and LAMBDA_BLOCKS_PER_PROC environment variables. **/
+  static void configureHardware () {
+    MPI_Comm hostComm;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &hostComm);
+    MPI_Comm_size(hostComm, &procsPerHost);
+    MPI_Comm_rank(hostComm, &hostProcId);
+    MPI_Comm_free(&hostComm);
+    detectTopology();
+
+    // One thread per physical core. If mpirun didn't bind the processes sharing a machine
+    // (so each may run anywhere), split the cores between them.
+    int usableCores = cores;
+#ifdef __linux__
+    if (procsPerHost > 1 && hardwareThreads >= sysconf(_SC_NPROCESSORS_ONLN)) {
+      usableCores = cores / procsPerHost;
+    }
+#endif
+    threadsPerProc = getEnvInt("LAMBDA_THREADS_PER_PROC", std::max(1, usableCores));
+
+    // Enough blocks to randomize the work, and a few per NUMA node so each can have its own.
+    // Every node computes the same layouts, so they must agree on blocksPerProc.
+    blocksPerProc = getEnvInt("LAMBDA_BLOCKS_PER_PROC",
+      std::max(MIN_BLOCKS_PER_PROC, BLOCKS_PER_NUMA_NODE * numaNodes));
+    MPI_Allreduce(MPI_IN_PLACE, &blocksPerProc, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  }
+
+  /** Pins each OpenMP thread to its own cpu, so threads keep using the memory they first
+      touched (see UberSequence::allocateSeqParts). Skipped if OMP_PROC_BIND is set, if
+      LAMBDA_PIN_THREADS=0, or if there are more threads than cpus. **/
+  static void pinThreads () {
+#ifdef __linux__
+    const char *pinThreads = getenv("LAMBDA_PIN_THREADS");
+    if (getenv("OMP_PROC_BIND") != NULL || (pinThreads != NULL && atoi(pinThreads) == 0) ||
+        cpuOrder.empty() || threadsPerProc > (int)cpuOrder.size()) {
+      return;
+    }
+
+    // If the nodes sharing this machine weren't bound by mpirun, give each its own cpus
+    int firstCpu = 0;
+    if (procsPerHost > 1 && hardwareThreads >= sysconf(_SC_NPROCESSORS_ONLN)) {
+      firstCpu = hostProcId * threadsPerProc;
+    }
+    #pragma omp parallel
+    {
+      int cpu = cpuOrder[(firstCpu + omp_get_thread_num()) % cpuOrder.size()];
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(cpu, &mask);
+      sched_setaffinity(0, sizeof(mask), &mask);
+    }
+#endif
+  }
 
   void init (int *argc, char ***argv) {
     MPI_Init(argc, argv);
     MPI_Comm_size(MPI_COMM_WORLD, &procs);
     MPI_Comm_rank(MPI_COMM_WORLD, &procId);
-    blocksPerProc = 5;
     char processor_name[MPI_MAX_PROCESSOR_NAME];
     int name_len;
     MPI_Get_processor_name(processor_name, &name_len);
     printf("%s\n", processor_name);
-    threadsPerProc = 2;
+    configureHardware();
     omp_set_num_threads(threadsPerProc);
+    pinThreads();
 
     // Get the time for a simple loop
     double start_time = CycleTimer::currentSeconds();
@@ -54,10 +231,73 @@ namespace Cluster {
     for (int i = 0; i < procs; i++) {
       systemTime += procTimes[i];
     }
+
+    // Until there are real measurements, assume speed is inversely proportional to the time
+    procSpeeds = new double[procs];
+    double totalSpeed = 0;
+    for (int i = 0; i < procs; i++) {
+      procSpeeds[i] = 1.0 / procTimes[i];
+      totalSpeed += procSpeeds[i];
+    }
+    for (int i = 0; i < procs; i++) {
+      procSpeeds[i] /= totalSpeed;
+    }
+  }
+
+  /** Every node passes in how many elements it processed in how many seconds of sequence
+      operations. Folds the measured throughputs into procSpeeds, and returns the imbalance
+      (the slowest node's time over the average node's time). Nodes that did no measurable
+      work (e.g. held none of the blocks of a slice) say nothing about their speed, so they
+      keep it and are left out of the imbalance. **/
+  double updateProcSpeeds (double elements, double seconds) {
+    double myMeasurement[2] = {elements, seconds};
+    double *measurements = new double[2 * procs];
+    MPI_Allgather(myMeasurement, 2, MPI_DOUBLE, measurements, 2, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    int numMeasured = 0;
+    double totalTime = 0;
+    double maxTime = 0;
+    double totalSpeed = 0;
+    double measuredShare = 0; // The share of procSpeeds the measured nodes split between them
+    for (int i = 0; i < procs; i++) {
+      double nodeElements = measurements[2 * i];
+      double nodeSeconds = measurements[2 * i + 1];
+      if (nodeElements > 0 && nodeSeconds >= MIN_NODE_SECONDS) {
+        numMeasured++;
+        totalTime += nodeSeconds;
+        maxTime = std::max(maxTime, nodeSeconds);
+        totalSpeed += nodeElements / nodeSeconds;
+        measuredShare += procSpeeds[i];
+      }
+    }
+    if (numMeasured < 2 || totalTime / numMeasured < MIN_MEASURED_SECONDS) {
+      delete[] measurements;
+      return 1.0;
+    }
+
+    double minSpeed = MIN_SPEED_SHARE / procs;
+    double totalShare = 0;
+    for (int i = 0; i < procs; i++) {
+      double nodeElements = measurements[2 * i];
+      double nodeSeconds = measurements[2 * i + 1];
+      if (nodeElements > 0 && nodeSeconds >= MIN_NODE_SECONDS) {
+        double speed = measuredShare * nodeElements / nodeSeconds / totalSpeed;
+        procSpeeds[i] = (1 - SPEED_SMOOTHING) * procSpeeds[i] + SPEED_SMOOTHING * speed;
+      }
+      procSpeeds[i] = std::max(procSpeeds[i], minSpeed);
+      totalShare += procSpeeds[i];
+    }
+    for (int i = 0; i < procs; i++) {
+      procSpeeds[i] /= totalShare;
+    }
+    delete[] measurements;
+    return maxTime / (totalTime / numMeasured);
   }
 
   void close () {
     delete[] procTimes;
+    delete[] procSpeeds;
+    Pool::clear();
     MPI_Finalize();
   }
 };
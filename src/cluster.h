@@ -8,9 +8,16 @@ namespace Cluster {
   extern int threadsPerProc;
   extern int systemTime;
   extern int *procTimes;
+  extern double *procSpeeds; // Each node's share of the cluster's throughput (sums to 1)
   // Information about this node
   extern int procId;
+  extern int procsPerHost; // Nodes (MPI processes) sharing this node's machine
+  extern int hardwareThreads; // Hardware threads this node may run on
+  extern int cores; // Physical cores those hardware threads belong to
+  extern int sockets;
+  extern int numaNodes;
   void init (int *argc, char ***argv);
+  double updateProcSpeeds (double elements, double seconds);
   void close ();
 };
 
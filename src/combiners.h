@@ -0,0 +1,211 @@
+#ifndef _COMBINERS_H_
+#define _COMBINERS_H_
+
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+/*
+ * What the sequence classes may assume about a combiner
+ *
+ * Every combiner must be associative. A combiner whose CombinerTraits say it is
+ * commutative too can be combined in any order, so e.g. UberSequence::reduce can
+ * combine a node's blocks locally and finish with a single MPI_Allreduce, instead
+ * of first moving the blocks' partial reduces to nodes that hold them in order.
+ *
+ * The built in combiners below (Sum, Min, Max, BitAnd, BitOr, BitXor) are also
+ * recognized by type: on arrays of arithmetic types, reduces and scans with them run
+ * as SIMD kernels (see simd.h), and they map onto MPI's predefined operations.
+ */
+
+template<typename Combiner>
+struct CombinerTraits
+{
+  static const bool commutative = false;
+  static const bool builtin = false;
+};
+
+/** Marks a combiner as commutative, e.g. seq.reduce(commutative(intMax), 0) **/
+template<typename Combiner>
+struct Commutative
+{
+  Combiner combiner;
+  Commutative (Combiner combiner) : combiner(combiner) {}
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return combiner(a, b);
+  }
+};
+
+template<typename Combiner>
+struct CombinerTraits<Commutative<Combiner> >
+{
+  static const bool commutative = true;
+  static const bool builtin = false;
+};
+
+template<typename Combiner>
+Commutative<Combiner> commutative (Combiner combiner) {
+  return Commutative<Combiner>(combiner);
+}
+
+/** Built in combiners. identity<T>() is the value that leaves others unchanged. **/
+struct Sum
+{
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return a + b;
+  }
+  template<typename T>
+  static T identity () {
+    return T(0);
+  }
+};
+
+struct Min
+{
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return a < b ? a : b;
+  }
+  template<typename T>
+  static T identity () {
+    return numeric_limits<T>::has_infinity ? numeric_limits<T>::infinity() :
+      numeric_limits<T>::max();
+  }
+};
+
+struct Max
+{
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return a < b ? b : a;
+  }
+  template<typename T>
+  static T identity () {
+    return numeric_limits<T>::has_infinity ? -numeric_limits<T>::infinity() :
+      numeric_limits<T>::lowest();
+  }
+};
+
+struct BitAnd
+{
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return a & b;
+  }
+  template<typename T>
+  static T identity () {
+    return ~T(0);
+  }
+};
+
+struct BitOr
+{
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return a | b;
+  }
+  template<typename T>
+  static T identity () {
+    return T(0);
+  }
+};
+
+struct BitXor
+{
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return a ^ b;
+  }
+  template<typename T>
+  static T identity () {
+    return T(0);
+  }
+};
+
+#define BUILTIN_COMBINER(Combiner)            \
+  template<>                                  \
+  struct CombinerTraits<Combiner>             \
+  {                                           \
+    static const bool commutative = true;     \
+    static const bool builtin = true;         \
+  };
+
+BUILTIN_COMBINER(Sum)
+BUILTIN_COMBINER(Min)
+BUILTIN_COMBINER(Max)
+BUILTIN_COMBINER(BitAnd)
+BUILTIN_COMBINER(BitOr)
+BUILTIN_COMBINER(BitXor)
+
+#undef BUILTIN_COMBINER
+
+/** Keeps the later of two values, e.g. to get the last element of a sequence as part of
+    a tuple of reduces **/
+struct Last
+{
+  template<typename T>
+  T operator() (const T &a, const T &b) const {
+    return b;
+  }
+};
+
+/** Combines (starts a segment, value) pairs, for segmented scans and reduces. A value that
+    starts a segment isn't combined with the values before it. **/
+template<typename Combiner>
+struct Segmented
+{
+  Combiner combiner;
+  Segmented (Combiner combiner) : combiner(combiner) {}
+
+  template<typename V>
+  pair<bool, V> operator() (const pair<bool, V> &a, const pair<bool, V> &b) const {
+    return pair<bool, V>(a.first || b.first, b.first ? b.second : combiner(a.second, b.second));
+  }
+};
+
+/** True if every one of Combiners is commutative **/
+template<typename... Combiners>
+struct AllCommutative : true_type {};
+
+template<typename Combiner, typename... Combiners>
+struct AllCommutative<Combiner, Combiners...> : integral_constant<bool,
+  CombinerTraits<Combiner>::commutative && AllCommutative<Combiners...>::value> {};
+
+/** Combines tuples element by element, element k with combiner k, so several reduces can
+    share one pass and one collective (see UberSequence::reduce(tuple, tuple)) **/
+template<typename... Combiners>
+struct TupleCombiner
+{
+  tuple<Combiners...> combiners;
+  TupleCombiner (tuple<Combiners...> combiners) : combiners(combiners) {}
+
+  template<typename Tuple>
+  Tuple operator() (const Tuple &a, const Tuple &b) const {
+    Tuple result;
+    combineFrom<0>(a, b, result, integral_constant<bool, sizeof...(Combiners) == 0>());
+    return result;
+  }
+
+  template<size_t K, typename Tuple>
+  void combineFrom (const Tuple &a, const Tuple &b, Tuple &result, false_type) const {
+    get<K>(result) = get<K>(combiners)(get<K>(a), get<K>(b));
+    combineFrom<K + 1>(a, b, result, integral_constant<bool, K + 1 == sizeof...(Combiners)>());
+  }
+
+  template<size_t K, typename Tuple>
+  void combineFrom (const Tuple &a, const Tuple &b, Tuple &result, true_type) const {}
+};
+
+template<typename... Combiners>
+struct CombinerTraits<TupleCombiner<Combiners...> >
+{
+  static const bool commutative = AllCommutative<Combiners...>::value;
+  static const bool builtin = false;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef _DELAYED_SEQUENCE_H_
+#define _DELAYED_SEQUENCE_H_
+
+#include <cassert>
+#include <type_traits>
+
+#include "uber_sequence.h"
+
+using namespace std;
+
+/** Loads mapper(loader(part, i)) **/
+template<typename T, typename Loader, typename Mapper>
+struct MapLoader
+{
+  Loader loader;
+  Mapper mapper;
+  MapLoader (Loader loader, Mapper mapper) : loader(loader), mapper(mapper) {}
+  T operator() (int part, int i) const {
+    return mapper(loader(part, i));
+  }
+};
+
+/** Loads zipper(loaderA(part, i), loaderB(part, i)) **/
+template<typename T, typename LoaderA, typename LoaderB, typename Zipper>
+struct ZipLoader
+{
+  LoaderA loaderA;
+  LoaderB loaderB;
+  Zipper zipper;
+  ZipLoader (LoaderA loaderA, LoaderB loaderB, Zipper zipper)
+    : loaderA(loaderA), loaderB(loaderB), zipper(zipper) {}
+  T operator() (int part, int i) const {
+    return zipper(loaderA(part, i), loaderB(part, i));
+  }
+};
+
+/*
+ * A sequence that hasn't been computed yet
+ *
+ * map, transform and zip only record a stage in the loader. The stages are run
+ * element by element inside the consuming reduce or scan (or force), so a chain
+ * like delay(seq).map(f).reduce(g, init) makes a single pass over each SeqPart of
+ * seq and never allocates the intermediate sequence.
+ *
+ * The delayed sequence has the layout of its source, which must outlive it.
+ */
+template<typename T, typename S, typename Loader>
+class DelayedSequence
+{
+public:
+  UberSequence<S> *source;
+  Loader loader;
+
+  DelayedSequence (UberSequence<S> *source, Loader loader) : source(source), loader(loader) {
+
+  }
+
+  int length () {
+    return source->size;
+  }
+
+  template<typename Mapper>
+  DelayedSequence<typename result_of<Mapper(T)>::type, S,
+                  MapLoader<typename result_of<Mapper(T)>::type, Loader, Mapper> >
+  map (Mapper mapper) {
+    typedef typename result_of<Mapper(T)>::type R;
+    return DelayedSequence<R, S, MapLoader<R, Loader, Mapper> >(source,
+      MapLoader<R, Loader, Mapper>(loader, mapper));
+  }
+
+  template<typename Mapper>
+  DelayedSequence<T, S, MapLoader<T, Loader, Mapper> > transform (Mapper mapper) {
+    return DelayedSequence<T, S, MapLoader<T, Loader, Mapper> >(source,
+      MapLoader<T, Loader, Mapper>(loader, mapper));
+  }
+
+  /** Pairs up elements with the same index. Both sequences must have the same layout
+      (e.g. one was mapped from the other, or copied with UberSequence::repartitionLike) **/
+  template<typename U, typename S2, typename Loader2, typename Zipper>
+  DelayedSequence<typename result_of<Zipper(T, U)>::type, S,
+                  ZipLoader<typename result_of<Zipper(T, U)>::type, Loader, Loader2, Zipper> >
+  zip (DelayedSequence<U, S2, Loader2> other, Zipper zipper) {
+    typedef typename result_of<Zipper(T, U)>::type R;
+    assert(source->hasSameLayout(other.source));
+    return DelayedSequence<R, S, ZipLoader<R, Loader, Loader2, Zipper> >(source,
+      ZipLoader<R, Loader, Loader2, Zipper>(loader, other.loader, zipper));
+  }
+
+  template<typename Combiner>
+  T reduce (Combiner combiner, T init) {
+    return source->reduceWith(loader, combiner, init);
+  }
+
+  /** Reduces with several combiners in one pass (see UberSequence::reduce(tuple, tuple)) **/
+  template<typename... Combiners, typename... Rs>
+  tuple<Rs...> reduce (tuple<Combiners...> combiners, tuple<Rs...> inits) {
+    return source->reduceWith(TupleLoader<Loader, Rs...>(loader),
+      TupleCombiner<Combiners...>(combiners), inits);
+  }
+
+  /** Returns a new sequence holding the scan of the delayed elements **/
+  template<typename Combiner>
+  UberSequence<T> *scan (Combiner combiner, T init) {
+    UberSequence<T> *newSeq = new UberSequence<T>;
+    newSeq->initializeLike(source);
+    source->scanWith(loader, PartStorer<T>(newSeq->mySeqParts), combiner, init);
+    return newSeq;
+  }
+
+  /** Computes all the delayed elements into a new sequence **/
+  UberSequence<T> *force () {
+    UberSequence<T> *newSeq = new UberSequence<T>;
+    newSeq->initializeLike(source);
+    newSeq->fillWith(loader);
+    return newSeq;
+  }
+};
+
+/** Starts a delayed pipeline on seq **/
+template<typename T>
+DelayedSequence<T, T, PartLoader<T> > delay (UberSequence<T> *seq) {
+  return DelayedSequence<T, T, PartLoader<T> >(seq, PartLoader<T>(seq->mySeqParts));
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _EXCHANGE_H_
+#define _EXCHANGE_H_
+
+#include <mpi.h>
+
+#include "cluster.h"
+#include "pool.h"
+
+using namespace std;
+
+/*
+ * Collective exchanges of variable amounts of elements between all the nodes
+ *
+ * Counts are in elements of T, and the elements for (or from) each node are packed one
+ * node after another, in order of procId. Elements are sent as bytes, like the
+ * sequence parts. Received elements come from Pool::allocateArray (unless the caller
+ * passes its own buffer), and are the caller's to free with Pool::deleteArray.
+ */
+namespace Exchange {
+  /** Sets displs[p] to the sum of counts[0..p), and returns the sum of all of them **/
+  inline int getDispls (const int *counts, int *displs) {
+    int total = 0;
+    for (int procId = 0; procId < Cluster::procs; procId++) {
+      displs[procId] = total;
+      total += counts[procId];
+    }
+    return total;
+  }
+
+  /** Sets recvcounts[p] to the number of elements node p sends this one, given how many
+      this node sends each node **/
+  inline void exchangeCounts (const int *sendcounts, int *recvcounts) {
+    MPI_Alltoall(const_cast<int*>(sendcounts), 1, MPI_INT, recvcounts, 1, MPI_INT,
+      MPI_COMM_WORLD);
+  }
+
+  /** Sends sendcounts[p] elements of sendbuf to node p, with one MPI_Alltoallv, into
+      recvbuf. recvcounts[p] is how many node p sends this one (from exchangeCounts, or
+      computed locally when every node knows them), and recvbuf holds as many elements
+      as they add up to (e.g. memory first touched by the threads that will use it). **/
+  template<typename T>
+  void alltoallv (const T *sendbuf, const int *sendcounts, const int *recvcounts,
+                  T *recvbuf) {
+    int procs = Cluster::procs;
+    int *sendbytes = Pool::newArray<int>(procs); // Note, this is in BYTES
+    int *sdispls = Pool::newArray<int>(procs); // Note, this is in BYTES
+    int *recvbytes = Pool::newArray<int>(procs); // Note, this is in BYTES
+    int *rdispls = Pool::newArray<int>(procs); // Note, this is in BYTES
+    for (int procId = 0; procId < procs; procId++) {
+      sendbytes[procId] = sendcounts[procId] * sizeof(T);
+      recvbytes[procId] = recvcounts[procId] * sizeof(T);
+    }
+    getDispls(sendbytes, sdispls);
+    getDispls(recvbytes, rdispls);
+    MPI_Alltoallv(const_cast<T*>(sendbuf), sendbytes, sdispls, MPI_BYTE, recvbuf,
+      recvbytes, rdispls, MPI_BYTE, MPI_COMM_WORLD);
+
+    // Clean up
+    Pool::deleteArray(sendbytes, procs);
+    Pool::deleteArray(sdispls, procs);
+    Pool::deleteArray(recvbytes, procs);
+    Pool::deleteArray(rdispls, procs);
+  }
+
+  /** Same, but returns the elements received in a new array **/
+  template<typename T>
+  T *alltoallv (const T *sendbuf, const int *sendcounts, const int *recvcounts) {
+    int numReceived = 0;
+    for (int procId = 0; procId < Cluster::procs; procId++) {
+      numReceived += recvcounts[procId];
+    }
+    T *recvbuf = Pool::allocateArray<T>(numReceived);
+    alltoallv(sendbuf, sendcounts, recvcounts, recvbuf);
+    return recvbuf;
+  }
+
+  /** Gathers every node's sendcount elements of sendbuf on every node, one node after
+      another. Sets recvcounts[p] to how many came from node p, and returns them. **/
+  template<typename T>
+  T *allgatherv (const T *sendbuf, int sendcount, int *recvcounts) {
+    int procs = Cluster::procs;
+    int *recvbytes = Pool::newArray<int>(procs); // Note, this is in BYTES
+    int *displs = Pool::newArray<int>(procs); // Note, this is in BYTES
+    int sendbytes = sendcount * sizeof(T);
+    MPI_Allgather(&sendbytes, 1, MPI_INT, recvbytes, 1, MPI_INT, MPI_COMM_WORLD);
+    for (int procId = 0; procId < procs; procId++) {
+      recvcounts[procId] = recvbytes[procId] / sizeof(T);
+    }
+    int numReceived = getDispls(recvbytes, displs) / sizeof(T);
+    T *recvbuf = Pool::allocateArray<T>(numReceived);
+    MPI_Allgatherv(const_cast<T*>(sendbuf), sendbytes, MPI_BYTE, recvbuf, recvbytes,
+      displs, MPI_BYTE, MPI_COMM_WORLD);
+
+    // Clean up
+    Pool::deleteArray(recvbytes, procs);
+    Pool::deleteArray(displs, procs);
+    return recvbuf;
+  }
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef _FUTURE_H_
+#define _FUTURE_H_
+
+#include <functional>
+#include <mpi.h>
+
+using namespace std;
+
+/*
+ * The result of an asynchronous sequence operation (e.g. UberSequence::reduceAsync)
+ *
+ * When the operation returns, the node's local work is done and its communication is
+ * in flight, so independent operations can be started before waiting for any of them.
+ * get() waits for the communication, then runs 'finish', which turns what was received
+ * into the result (and frees the operation's buffers). A future that is never waited
+ * on waits when it is destroyed, since the other nodes are taking part in the operation.
+ */
+template<typename R>
+class Future
+{
+  MPI_Request request;
+  function<R()> finish;
+  bool finished;
+  R value;
+
+public:
+  Future (MPI_Request request, function<R()> finish)
+    : request(request), finish(finish), finished(false) {}
+
+  Future (Future &&other)
+    : request(other.request), finish(other.finish), finished(other.finished),
+      value(other.value) {
+    other.request = MPI_REQUEST_NULL;
+    other.finished = true;
+  }
+
+  Future (const Future &other) = delete;
+  Future &operator= (const Future &other) = delete;
+
+  ~Future () {
+    if (!finished) {
+      get();
+    }
+  }
+
+  /** True if the communication is done, so get() won't have to wait for it **/
+  bool test () {
+    int done = 1;
+    if (!finished) {
+      MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    }
+    return done;
+  }
+
+  R get () {
+    if (!finished) {
+      MPI_Wait(&request, MPI_STATUS_IGNORE);
+      value = finish();
+      finished = true;
+    }
+    return value;
+  }
+};
+
+/** For operations like scanAsync that only update the sequence **/
+template<>
+class Future<void>
+{
+  MPI_Request request;
+  function<void()> finish;
+  bool finished;
+
+public:
+  Future (MPI_Request request, function<void()> finish)
+    : request(request), finish(finish), finished(false) {}
+
+  Future (Future &&other)
+    : request(other.request), finish(other.finish), finished(other.finished) {
+    other.request = MPI_REQUEST_NULL;
+    other.finished = true;
+  }
+
+  Future (const Future &other) = delete;
+  Future &operator= (const Future &other) = delete;
+
+  ~Future () {
+    if (!finished) {
+      get();
+    }
+  }
+
+  bool test () {
+    int done = 1;
+    if (!finished) {
+      MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    }
+    return done;
+  }
+
+  void get () {
+    if (!finished) {
+      MPI_Wait(&request, MPI_STATUS_IGNORE);
+      finish();
+      finished = true;
+    }
+  }
+};
+
+#endif
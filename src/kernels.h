@@ -0,0 +1,388 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <omp.h>
+
+#include "pool.h"
+#include "scheduler.h"
+#include "simd.h"
+
+using namespace std;
+
+/*
+ * Node-local kernels shared by the sequence classes
+ *
+ * The kernels work on all of a node's sequence parts at once. Elements are read
+ * through a 'loader' functor (loader(part, i) returns element i of a part) and
+ * written through a 'storer' functor (storer(part, i, value)), so the same kernel
+ * can run directly on SeqParts or on a fused pipeline of delayed stages.
+ *
+ * Loaders and storers that read and write parts as plain arrays (like PartLoader)
+ * say so by specializing ContiguousParts, and provide getPart(part). Reduces and
+ * scans through them with a built in combiner use the SIMD kernels in simd.h.
+ */
+template<typename LoaderOrStorer>
+struct ContiguousParts
+{
+  static const bool value = false;
+  typedef void Element; // The type of the arrays
+};
+
+namespace Kernels {
+  const int MIN_TILE_SIZE = 1024;
+  const int TILES_PER_THREAD = 16;
+  const int CHAINED_TILE_BYTES = 1 << 16; // Small enough to stay in cache between two reads
+
+  /** Reduces and scans split [0, numElements) into tiles, which the scheduler hands out to
+      threads. There are several tiles per thread so that threads can steal tiles, but few
+      enough that combining the per-tile results serially is cheap. **/
+  inline int getTileSize (int numElements) {
+    int numTiles = (numElements + MIN_TILE_SIZE - 1) / MIN_TILE_SIZE;
+    numTiles = max(1, min(numTiles, omp_get_max_threads() * TILES_PER_THREAD));
+    return max(1, (numElements + numTiles - 1) / numTiles);
+  }
+
+  /** Calls body(part, i) for every element i of every part. partOffsets[part] is the number
+      of elements before 'part', and partOffsets[numParts] is the total, so all the parts
+      are scheduled between the threads as if they were one range **/
+  template<typename Body>
+  void forEachElement (int numParts, int *partOffsets, Body body) {
+    Scheduler::parallelFor(partOffsets[numParts], [&](int begin, int end) {
+      int part = upper_bound(partOffsets, partOffsets + numParts + 1, begin) - partOffsets - 1;
+      for (int index = begin; index < end; part++) {
+        int partEnd = min(end, partOffsets[part + 1]);
+        int base = partOffsets[part];
+        for (int i = index - base; i < partEnd - base; i++) {
+          body(part, i);
+        }
+        index = partEnd;
+      }
+    });
+  }
+
+  /** A range [begin, end) of sequence part 'part' **/
+  struct Tile
+  {
+    int part;
+    int begin;
+    int end;
+  };
+
+  /** Called by scans with the tiles they will use (start), and after each tile is scanned
+      (operator()), while the tile's elements are still in cache. This one does nothing. **/
+  struct NoTileHook
+  {
+    void start (vector<Tile> &tiles) {}
+    void operator() (int t, Tile &tile) {}
+  };
+
+  /** Cuts every part into tiles of at most tileSize elements, in order. Tiles don't cross
+      parts, so the tiles of a part are consecutive, and all the parts' tiles are scheduled
+      as one pool. **/
+  inline vector<Tile> getTiles (int numParts, int *partOffsets, int tileSize) {
+    vector<Tile> tiles;
+    for (int part = 0; part < numParts; part++) {
+      int numElements = partOffsets[part + 1] - partOffsets[part];
+      for (int begin = 0; begin < numElements; begin += tileSize) {
+        Tile tile;
+        tile.part = part;
+        tile.begin = begin;
+        tile.end = min(numElements, begin + tileSize);
+        tiles.push_back(tile);
+      }
+    }
+    return tiles;
+  }
+
+  inline vector<Tile> getTiles (int numParts, int *partOffsets) {
+    return getTiles(numParts, partOffsets, getTileSize(partOffsets[numParts]));
+  }
+
+  /** True if tiles of T loaded by Loader (and stored by Storer) can use Simd **/
+  template<typename T, typename Combiner, typename Loader, typename Storer = Loader>
+  struct UseSimd : integral_constant<bool,
+    is_same<typename ContiguousParts<Loader>::Element, T>::value &&
+    is_same<typename ContiguousParts<Storer>::Element, T>::value &&
+    Simd::Supported<T, Combiner>::value> {};
+
+  template<typename T, typename Loader, typename Combiner>
+  T reduceTile (Tile &tile, Loader &loader, Combiner &combiner, false_type) {
+    T reduce = loader(tile.part, tile.begin);
+    for (int i = tile.begin + 1; i < tile.end; i++) {
+      reduce = combiner(reduce, loader(tile.part, i));
+    }
+    return reduce;
+  }
+
+  template<typename T, typename Loader, typename Combiner>
+  T reduceTile (Tile &tile, Loader &loader, Combiner &combiner, true_type) {
+    return Simd::reduce(loader.getPart(tile.part) + tile.begin, tile.end - tile.begin, combiner);
+  }
+
+  /** Gets reduces for each tile (which must be non-empty) into tileReduces
+      E.g. if a part is (1, 3, 5, 2, 8, 1) and the tile size is 3
+           then the tile reduces are 9 and 11 **/
+  template<typename T, typename Loader, typename Combiner>
+  void getTileReduces (vector<Tile> &tiles, Loader loader, Combiner combiner, T *tileReduces) {
+    Scheduler::parallelFor(tiles.size(), 1, [&](int begin, int end) {
+      for (int t = begin; t < end; t++) {
+        tileReduces[t] = reduceTile<T>(tiles[t], loader, combiner,
+          UseSimd<T, Combiner, Loader>());
+      }
+    });
+  }
+
+  /** Combines the tile reduces of each part into partReduces[part] **/
+  template<typename T, typename Combiner>
+  void getPartReduces (vector<Tile> &tiles, T *tileReduces, Combiner combiner, T *partReduces) {
+    for (size_t t = 0; t < tiles.size(); t++) {
+      if (tiles[t].begin == 0) {
+        partReduces[tiles[t].part] = tileReduces[t];
+      } else {
+        partReduces[tiles[t].part] = combiner(partReduces[tiles[t].part], tileReduces[t]);
+      }
+    }
+  }
+
+  /** Makes the tile reduces into the scans before each tile, given the scans before each
+      part. E.g. with + a part with tile reduces (1, 3, 6) and part init 5 gets (5, 6, 9) **/
+  template<typename T, typename Combiner>
+  void makeTileInits (vector<Tile> &tiles, T *tileReduces, Combiner combiner, T *partInits) {
+    T scan = T();
+    for (size_t t = 0; t < tiles.size(); t++) {
+      if (tiles[t].begin == 0) {
+        scan = partInits[tiles[t].part];
+      }
+      T reduce = tileReduces[t];
+      tileReduces[t] = scan;
+      scan = combiner(scan, reduce);
+    }
+  }
+
+  /** Let's say a tile is (1, 4, 2), combiner is + and the tile's init is 5.
+      Then (5+1, 5+1+4, 5+1+4+2) is passed to storer.
+      In effect 'applying' the scan to the tiles **/
+  template<typename T, typename Loader, typename Storer, typename Combiner>
+  void applyTileScans (vector<Tile> &tiles, Loader loader, Storer storer, Combiner combiner,
+                       T *tileInits) {
+    NoTileHook hook;
+    applyTileScans(tiles, loader, storer, combiner, tileInits, hook);
+  }
+
+  /** Same, but calls hook(t, tiles[t]) right after tile t is scanned **/
+  template<typename T, typename Loader, typename Storer, typename Combiner, typename Hook>
+  void applyTileScans (vector<Tile> &tiles, Loader loader, Storer storer, Combiner combiner,
+                       T *tileInits, Hook &hook) {
+    Scheduler::parallelFor(tiles.size(), 1, [&](int begin, int end) {
+      for (int t = begin; t < end; t++) {
+        scanTile(tiles[t], loader, storer, combiner, tileInits[t],
+          UseSimd<T, Combiner, Loader, Storer>());
+        hook(t, tiles[t]);
+      }
+    });
+  }
+
+  template<typename T, typename Loader, typename Storer, typename Combiner>
+  void scanTile (Tile &tile, Loader &loader, Storer &storer, Combiner &combiner, T init,
+                 false_type) {
+    T scan = init;
+    for (int i = tile.begin; i < tile.end; i++) {
+      scan = combiner(scan, loader(tile.part, i));
+      storer(tile.part, i, scan);
+    }
+  }
+
+  template<typename T, typename Loader, typename Storer, typename Combiner>
+  void scanTile (Tile &tile, Loader &loader, Storer &storer, Combiner &combiner, T init,
+                 true_type) {
+    Simd::scan(loader.getPart(tile.part) + tile.begin, storer.getPart(tile.part) + tile.begin,
+      tile.end - tile.begin, init, combiner);
+  }
+
+  enum TileState { TILE_PENDING, TILE_AGGREGATE, TILE_PREFIX };
+
+  /** What a tile of a chained scan has published for the tiles after it. Padded to avoid
+      false sharing **/
+  template<typename T>
+  struct TileStatus
+  {
+    atomic<int> state;
+    T aggregate; // The tile's reduce, once state is TILE_AGGREGATE
+    T prefix;    // The scan up to the end of the tile, once state is TILE_PREFIX
+    char padding[64];
+
+    TileStatus () : state(TILE_PENDING) {}
+  };
+
+  /** Gets the scan before tile t by walking back over the tiles before it, combining their
+      aggregates until one has published its prefix. Tile 0 always publishes a prefix. **/
+  template<typename T, typename Combiner>
+  T lookBack (TileStatus<T> *status, int t, Combiner &combiner) {
+    T aggregates = T();
+    bool haveAggregates = false;
+    for (int p = t - 1; ; p--) {
+      int state;
+      while ((state = status[p].state.load(memory_order_acquire)) == TILE_PENDING) {
+        this_thread::yield();
+      }
+      if (state == TILE_PREFIX) {
+        return haveAggregates ? combiner(status[p].prefix, aggregates) : status[p].prefix;
+      }
+      aggregates = haveAggregates ? combiner(status[p].aggregate, aggregates) :
+        status[p].aggregate;
+      haveAggregates = true;
+    }
+  }
+
+  /** Tiles for chainedScan, small enough for a tile of elementBytes sized elements to stay
+      in cache between its reduce and its scan **/
+  inline vector<Tile> getChainedTiles (int numParts, int *partOffsets, int elementBytes) {
+    int cacheTileSize = max(1, CHAINED_TILE_BYTES / elementBytes);
+    return getTiles(numParts, partOffsets,
+      min(cacheTileSize, getTileSize(partOffsets[numParts])));
+  }
+
+  /** Scans all the tiles as one range, starting from init, in a single pass (decoupled
+      look-back). Each tile is reduced, publishes its reduce, looks back for the scan before
+      it, publishes its own prefix and is scanned while it is still in cache, so each
+      element is read from memory and written once. Tiles are claimed in order, so every
+      tile a thread waits for has been claimed by a thread that won't wait before
+      publishing its reduce. hook is called after each tile, as in applyTileScans. **/
+  template<typename T, typename Loader, typename Storer, typename Combiner, typename Hook>
+  void chainedScan (vector<Tile> &tiles, Loader loader, Storer storer, Combiner combiner,
+                    T init, Hook &hook) {
+    int numTiles = tiles.size();
+    TileStatus<T> *status = Pool::newArray<TileStatus<T> >(numTiles);
+    atomic<int> nextTile(0);
+
+    #pragma omp parallel
+    {
+      for (int t = nextTile++; t < numTiles; t = nextTile++) {
+        T aggregate = reduceTile<T>(tiles[t], loader, combiner, UseSimd<T, Combiner, Loader>());
+        T before = init;
+        if (t > 0) {
+          status[t].aggregate = aggregate;
+          status[t].state.store(TILE_AGGREGATE, memory_order_release);
+          before = lookBack(status, t, combiner);
+        }
+        status[t].prefix = combiner(before, aggregate);
+        status[t].state.store(TILE_PREFIX, memory_order_release);
+        scanTile(tiles[t], loader, storer, combiner, before,
+          UseSimd<T, Combiner, Loader, Storer>());
+        hook(t, tiles[t]);
+      }
+    }
+    Pool::deleteArray(status, numTiles);
+  }
+
+  /** Returns how many of the first k elements of the merge of sorted arrays a and b come
+      from a, where equal elements come from a first (as in std::merge) **/
+  template<typename T, typename Comparator>
+  int mergeSplit (const T *a, int na, const T *b, int nb, int k, Comparator &comparator) {
+    int lo = max(0, k - nb);
+    int hi = min(k, na);
+    while (lo < hi) {
+      int i = lo + (hi - lo) / 2;
+      if (comparator(b[k - i - 1], a[i])) {
+        hi = i;
+      } else {
+        lo = i + 1;
+      }
+    }
+    return lo;
+  }
+
+  /** Merges the sorted runs [offsets[r], offsets[r + 1]) of data pairwise, round by round.
+      Every merge is cut into tiles with mergeSplit, so all the threads take part even in
+      the last rounds. Returns the buffer (data or scratch) that holds the merged result. **/
+  template<typename T, typename Comparator>
+  T *mergeRuns (T *data, T *scratch, vector<int> offsets, Comparator comparator) {
+    int n = offsets.back();
+    int tileSize = getTileSize(n);
+    while (offsets.size() > 2) {
+      int numRuns = offsets.size() - 1;
+      // Each tile is [begin, end) of the output of the merge of runs 'run' and 'run' + 1
+      vector<Tile> tiles;
+      vector<int> merged;
+      for (int run = 0; run < numRuns; run += 2) {
+        merged.push_back(offsets[run]);
+        int mergeEnd = offsets[min(run + 2, numRuns)];
+        for (int begin = offsets[run]; begin < mergeEnd; begin += tileSize) {
+          Tile tile;
+          tile.part = run;
+          tile.begin = begin;
+          tile.end = min(mergeEnd, begin + tileSize);
+          tiles.push_back(tile);
+        }
+      }
+      merged.push_back(n);
+
+      Scheduler::parallelFor(tiles.size(), 1, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+          int run = tiles[t].part;
+          T *a = data + offsets[run];
+          int na = offsets[run + 1] - offsets[run];
+          T *b = data + offsets[run + 1];
+          int nb = run + 1 < numRuns ? offsets[run + 2] - offsets[run + 1] : 0;
+          int k0 = tiles[t].begin - offsets[run];
+          int k1 = tiles[t].end - offsets[run];
+          int i0 = mergeSplit(a, na, b, nb, k0, comparator);
+          int i1 = mergeSplit(a, na, b, nb, k1, comparator);
+          std::merge(a + i0, a + i1, b + (k0 - i0), b + (k1 - i1), scratch + tiles[t].begin,
+            comparator);
+        }
+      });
+      swap(data, scratch);
+      offsets = merged;
+    }
+    return data;
+  }
+
+  /** Sorts data[0, n) with all the threads: each thread's share is sorted, then the shares
+      are merged. Returns the buffer (data or scratch, both n long) that holds the result. **/
+  template<typename T, typename Comparator>
+  T *sort (T *data, T *scratch, int n, Comparator comparator) {
+    int runSize = max(MIN_TILE_SIZE, (n + omp_get_max_threads() - 1) / omp_get_max_threads());
+    vector<int> offsets;
+    for (int begin = 0; begin < n; begin += runSize) {
+      offsets.push_back(begin);
+    }
+    offsets.push_back(n);
+    int numRuns = offsets.size() - 1;
+    Scheduler::parallelFor(numRuns, 1, [&](int begin, int end) {
+      for (int run = begin; run < end; run++) {
+        std::sort(data + offsets[run], data + offsets[run + 1], comparator);
+      }
+    });
+    return mergeRuns(data, scratch, offsets, comparator);
+  }
+
+  /** A scan hook that reduces each tile's scanned elements (read through loader) into
+      tileReduces, so a reduce of a scan's results costs no extra pass over memory **/
+  template<typename R, typename Loader, typename Combiner>
+  struct TileReducer
+  {
+    Loader loader;
+    Combiner combiner;
+    vector<Tile> *tiles;
+    R *tileReduces;
+
+    TileReducer (Loader loader, Combiner combiner)
+      : loader(loader), combiner(combiner), tiles(NULL), tileReduces(NULL) {}
+
+    void start (vector<Tile> &tiles) {
+      this->tiles = &tiles;
+      this->tileReduces = Pool::newArray<R>(tiles.size());
+    }
+
+    void operator() (int t, Tile &tile) {
+      tileReduces[t] = reduceTile<R>(tile, loader, combiner, UseSimd<R, Combiner, Loader>());
+    }
+  };
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef _KEY_TABLE_H_
+#define _KEY_TABLE_H_
+
+#include <cstdint>
+#include <functional>
+
+#include "pool.h"
+
+using namespace std;
+
+/*
+ * Hash table from keys to combined values, for UberSequence::reduceByKey
+ *
+ * Open addressing: the slots are one array, probed linearly from the key's hash, so
+ * a lookup usually touches a single cache line. The slot comes from the high bits of
+ * the hash times a large odd constant, so keys that share low bits (e.g. the keys a
+ * node owns) still spread over the table. The table doubles when it is half full.
+ * Keys need operator== and std::hash.
+ */
+template<typename K, typename V>
+class KeyTable
+{
+  struct Slot
+  {
+    K key;
+    V value;
+    bool used;
+  };
+
+  static const int MIN_CAPACITY = 16;
+
+  Slot *slots;
+  int capacity;
+  int count;
+  int shift; // 64 - log2(capacity)
+
+  int getSlot (const K &key) const {
+    uint64_t h = (uint64_t)hash<K>()(key) * 0x9E3779B97F4A7C15ull;
+    return (int)(h >> shift);
+  }
+
+  /** Finds key's slot, or the empty slot where it goes **/
+  int find (const K &key) const {
+    int slot = getSlot(key);
+    while (slots[slot].used && !(slots[slot].key == key)) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+  }
+
+  void allocate (int newCapacity) {
+    slots = Pool::newArray<Slot>(newCapacity);
+    capacity = newCapacity;
+    count = 0;
+    shift = 64;
+    for (int size = 1; size < capacity; size *= 2) {
+      shift--;
+    }
+  }
+
+  void grow () {
+    Slot *oldSlots = slots;
+    int oldCapacity = capacity;
+    allocate(2 * capacity);
+    for (int slot = 0; slot < oldCapacity; slot++) {
+      if (oldSlots[slot].used) {
+        slots[find(oldSlots[slot].key)] = oldSlots[slot];
+        count++;
+      }
+    }
+    Pool::deleteArray(oldSlots, oldCapacity);
+  }
+
+public:
+  KeyTable () {
+    allocate(MIN_CAPACITY);
+  }
+
+  ~KeyTable () {
+    Pool::deleteArray(slots, capacity);
+  }
+
+  KeyTable (const KeyTable &other) = delete;
+  KeyTable &operator= (const KeyTable &other) = delete;
+
+  /** Combines value into key's value, or adds key with value if it isn't there **/
+  template<typename Combiner>
+  void add (const K &key, const V &value, Combiner &combiner) {
+    if (2 * (count + 1) > capacity) {
+      grow();
+    }
+    int slot = find(key);
+    if (slots[slot].used) {
+      slots[slot].value = combiner(slots[slot].value, value);
+    } else {
+      slots[slot].key = key;
+      slots[slot].value = value;
+      slots[slot].used = true;
+      count++;
+    }
+  }
+
+  /** The number of distinct keys **/
+  int size () const {
+    return count;
+  }
+
+  /** Calls f(key, value) for every key, in slot order **/
+  template<typename F>
+  void forEach (F f) const {
+    for (int slot = 0; slot < capacity; slot++) {
+      if (slots[slot].used) {
+        f(slots[slot].key, slots[slot].value);
+      }
+    }
+  }
+};
+
+#endif
@@ -8,7 +8,9 @@
 // test implementations
 #include "paren_match.h"
 #include "mandelbrot.h"
+#include "primitives.h"
 #include "uber_sequence.h"
+#include "delayed_sequence.h"
 #include "parallel_sequence.h"
 #include "serial_sequence.h"
 #include "cluster.h"
@@ -16,7 +18,6 @@
 #include "CycleTimer.h"
 
 int knapsack (UberSequence< pair<int, int> > *items, int weight) {
-  auto intMax = [](int x, int y) { return max(x, y); };
   int money[weight+1];
   money[0] = 0;
   for (int i = 1; i <= weight; i++) {
@@ -25,9 +26,7 @@ int knapsack (UberSequence< pair<int, int> > *items, int weight) {
       if (i - item.first < 0) return 0;
       return money[i - item.first] + item.second;
     };
-    Sequence<int> *bests = items->map(bestUsing);
-    money[i] = bests->reduce(intMax, 0);
-    delete bests;
+    money[i] = delay(items).map(bestUsing).reduce(Max(), 0);
   }
   return money[weight];
 }
@@ -43,6 +42,9 @@ int main (int argc, char **argv) {
   // paren test
   test_paren_match(20000000);
 
+  // sequence primitive tests
+  test_primitives(100000);
+
   // mandelbrot test
   // test_mandelbrot();
 
@@ -53,7 +53,8 @@ Sequence<int> *mandelbrot_helper(float x0, float y0,
   };
 
   if (parallelize) {
-    return new UberSequence<int>(mandel_idx, width * height);
+    // The cost per pixel varies a lot, so let nodes claim blocks as they go
+    return new UberSequence<int>(mandel_idx, width * height, DYNAMIC_BALANCING);
   }
   else {
     return new SerialSequence<int>(mandel_idx, width * height);
@@ -0,0 +1,235 @@
+#ifndef _NESTED_SEQUENCE_H_
+#define _NESTED_SEQUENCE_H_
+
+#include <cassert>
+#include <functional>
+#include <iostream>
+#include <type_traits>
+
+#include "uber_sequence.h"
+
+using namespace std;
+
+/*
+ * A sequence of sequences of T, of any lengths (e.g. a graph's adjacency lists)
+ *
+ * The inner sequences are stored flattened, one after another, in one UberSequence, so
+ * they are spread over the cluster by their number of elements rather than their
+ * number of inner sequences: a few long inner sequences don't leave one node with all
+ * the work. offsets and lengths say where each inner sequence is, and starts flags the
+ * first element of each, so nested operations run as flat (map, transform) or segmented
+ * (scan, reduce) operations over all the elements at once.
+ */
+template<typename T>
+class NestedSequence
+{
+public:
+  UberSequence<T> *values;     // The elements of all the inner sequences, in order
+  UberSequence<int> *offsets;  // offsets[s] is where inner sequence s starts in values
+  UberSequence<int> *lengths;  // lengths[s] is the length of inner sequence s
+  UberSequence<bool> *starts;  // True for the values that start an inner sequence
+
+  /** Takes ownership of the parts of an existing nested sequence **/
+  NestedSequence (UberSequence<T> *values, UberSequence<int> *offsets,
+                  UberSequence<int> *lengths, UberSequence<bool> *starts)
+    : values(values), offsets(offsets), lengths(lengths), starts(starts) {}
+
+  /** n inner sequences (n may be 0), where inner sequence s has lengthOf(s) elements, and
+      its element j is generator(s, j) **/
+  NestedSequence (function<int(int)> lengthOf, function<T(int, int)> generator, int n) {
+    if (n == 0) {
+      lengths = newEmpty<int>();
+      offsets = newEmpty<int>();
+      values = newEmpty<T>();
+      starts = newEmpty<bool>();
+      return;
+    }
+    lengths = new UberSequence<int>(lengthOf, n);
+    UberSequence<int> ends(lengthOf, lengths);
+    ends.scan(Sum(), 0);
+    offsets = ends.zipWith(lengths, [](int end, int length) { return end - length; });
+    int totalLength = ends.get(n - 1);
+    if (totalLength == 0) {
+      values = newEmpty<T>();
+      starts = newEmpty<bool>();
+      return;
+    }
+
+    // Mark where each inner sequence starts with its number and offset, then fill in the
+    // values after them with scans. Empty inner sequences start at the same offset as the
+    // next one, which is larger, so Max keeps the non-empty one.
+    values = new UberSequence<T>;
+    UberSequence<int> sequenceOf([](int i) { return -1; }, totalLength);
+    UberSequence<int> startOf([](int i) { return 0; }, &sequenceOf);
+    int myInnerSequences = offsets->getPartOffsets()[offsets->numParts];
+    int *indices = Pool::newArray<int>(myInnerSequences);
+    int *sequences = Pool::newArray<int>(myInnerSequences);
+    int numMarks = 0;
+    for (int part = 0; part < offsets->numParts; part++) {
+      SeqPart<int> &offsetPart = offsets->mySeqParts[part];
+      for (int i = 0; i < offsetPart.numElements; i++) {
+        if (offsetPart.data[i] < totalLength) {
+          indices[numMarks] = offsetPart.data[i];
+          sequences[numMarks] = offsetPart.startIndex + i;
+          numMarks++;
+        }
+      }
+    }
+    sequenceOf.scatter(indices, sequences, numMarks, Max());
+    startOf.scatter(indices, indices, numMarks, Max());
+    sequenceOf.scan(Max(), -1);
+    startOf.scan(Max(), 0);
+    Pool::deleteArray(indices, myInnerSequences);
+    Pool::deleteArray(sequences, myInnerSequences);
+
+    values->initializeLike(&sequenceOf);
+    SeqPart<int> *sequenceParts = sequenceOf.mySeqParts;
+    SeqPart<int> *startParts = startOf.mySeqParts;
+    values->fillWith([sequenceParts, startParts, &generator](int part, int i) {
+      int index = sequenceParts[part].startIndex + i;
+      return generator(sequenceParts[part].data[i], index - startParts[part].data[i]);
+    });
+    starts = new UberSequence<bool>;
+    starts->initializeLike(values);
+    starts->fillWith([startParts](int part, int i) {
+      return startParts[part].startIndex + i == startParts[part].data[i];
+    });
+  }
+
+  ~NestedSequence () {
+    delete values;
+    delete offsets;
+    delete lengths;
+    delete starts;
+  }
+
+  /** The number of inner sequences **/
+  int length () {
+    return offsets->length();
+  }
+
+  /** The number of elements in all the inner sequences **/
+  int totalLength () {
+    return values->length();
+  }
+
+  /** Element j of inner sequence s **/
+  T get (int s, int j) {
+    assert(0 <= j && j < lengths->get(s));
+    return values->get(offsets->get(s) + j);
+  }
+
+  /** Returns the nested sequence of mapper(x) for every element x of every inner sequence **/
+  template<typename Mapper>
+  NestedSequence<typename result_of<Mapper(T)>::type> *map (Mapper mapper) {
+    typedef typename result_of<Mapper(T)>::type S;
+    UberSequence<S> *newValues = new UberSequence<S>;
+    newValues->initializeLike(values);
+    SeqPart<T> *parts = values->mySeqParts;
+    newValues->fillWith([parts, &mapper](int part, int i) {
+      return mapper(parts[part].data[i]);
+    });
+    return new NestedSequence<S>(newValues, copyOf(offsets), copyOf(lengths), copyOf(starts));
+  }
+
+  template<typename Mapper>
+  void transform (Mapper mapper) {
+    values->transform(mapper);
+  }
+
+  /** Scans every inner sequence separately, starting from init **/
+  template<typename Combiner>
+  void scan (Combiner combiner, T init) {
+    if (totalLength() == 0) {
+      return;
+    }
+    values->segmentedScan(starts, combiner, init);
+  }
+
+  /** Returns a sequence (laid out like offsets) with init combined with the elements of
+      each inner sequence. Empty inner sequences reduce to init. **/
+  template<typename Combiner>
+  UberSequence<T> *reduce (Combiner combiner, T init) {
+    if (totalLength() == 0) {
+      UberSequence<T> *newSeq = new UberSequence<T>;
+      newSeq->initializeLike(lengths);
+      newSeq->fillWith([init](int part, int i) { return init; });
+      return newSeq;
+    }
+    UberSequence<T> *nonEmptyReduces = values->segmentedReduce(starts, combiner, init);
+
+    // Inner sequence s's reduce is at the number of non-empty inner sequences before it
+    UberSequence<int> nonEmptyBefore;
+    nonEmptyBefore.initializeLike(lengths);
+    SeqPart<int> *lengthParts = lengths->mySeqParts;
+    nonEmptyBefore.fillWith([lengthParts](int part, int i) {
+      return lengthParts[part].data[i] > 0 ? 1 : 0;
+    });
+    nonEmptyBefore.scan(Sum(), 0);
+    int myInnerSequences = lengths->getPartOffsets()[lengths->numParts];
+    int *indices = Pool::newArray<int>(myInnerSequences);
+    T *reduces = Pool::newArray<T>(myInnerSequences);
+    int numNonEmpty = 0;
+    for (int part = 0; part < lengths->numParts; part++) {
+      for (int i = 0; i < lengthParts[part].numElements; i++) {
+        if (lengthParts[part].data[i] > 0) {
+          indices[numNonEmpty++] = nonEmptyBefore.mySeqParts[part].data[i] - 1;
+        }
+      }
+    }
+    nonEmptyReduces->get(indices, numNonEmpty, reduces);
+
+    UberSequence<T> *newSeq = new UberSequence<T>;
+    newSeq->initializeLike(lengths);
+    int next = 0;
+    for (int part = 0; part < lengths->numParts; part++) {
+      for (int i = 0; i < lengthParts[part].numElements; i++) {
+        newSeq->mySeqParts[part].data[i] = lengthParts[part].data[i] > 0 ? reduces[next++] :
+          init;
+      }
+    }
+
+    Pool::deleteArray(indices, myInnerSequences);
+    Pool::deleteArray(reduces, myInnerSequences);
+    delete nonEmptyReduces;
+    return newSeq;
+  }
+
+  void print () {
+    for (int s = 0; s < length(); s++) {
+      int offset = offsets->get(s);
+      int length = lengths->get(s);
+      if (Cluster::procId == 0) {
+        cout << "[";
+      }
+      for (int j = 0; j < length; j++) {
+        T value = values->get(offset + j);
+        if (Cluster::procId == 0) {
+          cout << (j > 0 ? ", " : "") << value;
+        }
+      }
+      if (Cluster::procId == 0) {
+        cout << "]" << endl;
+      }
+    }
+  }
+
+  /** A sequence with no elements (and no blocks) **/
+  template<typename S>
+  static UberSequence<S> *newEmpty () {
+    UberSequence<S> *seq = new UberSequence<S>;
+    seq->takeNodeBlock(Pool::newArray<S>(0), 0);
+    return seq;
+  }
+
+  /** A copy of seq, with the same layout **/
+  template<typename S>
+  static UberSequence<S> *copyOf (UberSequence<S> *seq) {
+    UberSequence<S> *newSeq = new UberSequence<S>;
+    newSeq->initializeLike(seq);
+    newSeq->fillWith(PartLoader<S>(seq->mySeqParts));
+    return newSeq;
+  }
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <limits>
 #include <functional>
+#include <tuple>
 #include <vector>
 
 #include "paren_match.h"
@@ -25,18 +26,21 @@ bool paren_match(int *data, int dataSize) {
  * and -1's as close parens.
  */
 bool paren_match(Sequence<int> &seq) {
-  auto plus = [](int a, int b) {
-    return a + b;
-  };
+  seq.scan(Sum(), 0);
 
-  auto min = [](int a, int b) {
-    return a < b ? a : b;
-  };
-
-  seq.scan(plus, 0);
+  int int_max = std::numeric_limits<int>::max();
+  return seq.get(seq.length() - 1) == 0 && seq.reduce(Min(), int_max) >= 0;
+}
 
+/*
+ * Same as above, but the lowest and last sums are reduced while the scan writes them,
+ * with one collective for both
+ */
+bool paren_match(UberSequence<int> &seq) {
   int int_max = std::numeric_limits<int>::max();
-  return seq.get(seq.length() - 1) == 0 && seq.reduce(min, int_max) >= 0;
+  std::tuple<int, int> sums = seq.scanAndReduce(Sum(), 0, std::make_tuple(Min(), Last()),
+    std::make_tuple(int_max, 0));
+  return std::get<1>(sums) == 0 && std::get<0>(sums) >= 0;
 }
 
 /*
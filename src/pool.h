@@ -0,0 +1,154 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "scheduler.h"
+
+using namespace std;
+
+#define POOL_MAX_BLOCK_BYTES (1 << 20) // Larger allocations go straight to the heap, at their size
+#define POOL_MAX_CACHED_BYTES (32 << 20) // Free memory the pool may hold on to, per node
+
+/*
+ * Size class pool for the memory the sequence classes allocate over and over
+ *
+ * Loops like knapsack() run map + reduce many thousands of times, and each call allocates
+ * (and frees) the same sequence parts, responsibilities and scratch buffers. Freed blocks
+ * of up to POOL_MAX_BLOCK_BYTES are kept on a free list per power of two size and handed
+ * out again, instead of going back to the heap. Larger blocks (e.g. the data of big
+ * sequence parts) are allocated at their exact size and freed right away: rounding them
+ * up would waste up to half their memory, and a reused block keeps the pages other
+ * threads first touched, rather than getting new ones placed by its new user.
+ */
+namespace Pool {
+  const int MIN_CLASS_BYTES = 64;
+  const int NUM_CLASSES = 48;
+
+  struct FreeLists
+  {
+    vector<void*> blocks[NUM_CLASSES];
+    size_t cachedBytes;
+  };
+
+  inline FreeLists &getFreeLists () {
+    static FreeLists freeLists;
+    return freeLists;
+  }
+
+  /** The size class of a block of numBytes, i.e. it is rounded up to
+      MIN_CLASS_BYTES << sizeClass bytes **/
+  inline int getSizeClass (size_t numBytes) {
+    int sizeClass = 0;
+    while (((size_t)MIN_CLASS_BYTES << sizeClass) < numBytes) {
+      sizeClass++;
+    }
+    return sizeClass;
+  }
+
+  /** Returns uninitialized memory for numBytes **/
+  inline void *allocate (size_t numBytes) {
+    if (numBytes > POOL_MAX_BLOCK_BYTES) {
+      return ::operator new(numBytes);
+    }
+    int sizeClass = getSizeClass(numBytes);
+    void *block = NULL;
+    #pragma omp critical(pool)
+    {
+      FreeLists &freeLists = getFreeLists();
+      if (!freeLists.blocks[sizeClass].empty()) {
+        block = freeLists.blocks[sizeClass].back();
+        freeLists.blocks[sizeClass].pop_back();
+        freeLists.cachedBytes -= (size_t)MIN_CLASS_BYTES << sizeClass;
+      }
+    }
+    if (block == NULL) {
+      block = ::operator new((size_t)MIN_CLASS_BYTES << sizeClass);
+    }
+    return block;
+  }
+
+  /** Gives back memory from allocate(numBytes) **/
+  inline void release (void *block, size_t numBytes) {
+    if (block == NULL) {
+      return;
+    }
+    if (numBytes > POOL_MAX_BLOCK_BYTES) {
+      ::operator delete(block);
+      return;
+    }
+    size_t classBytes = (size_t)MIN_CLASS_BYTES << getSizeClass(numBytes);
+    bool cached = false;
+    #pragma omp critical(pool)
+    {
+      FreeLists &freeLists = getFreeLists();
+      if (freeLists.cachedBytes + classBytes <= POOL_MAX_CACHED_BYTES) {
+        freeLists.blocks[getSizeClass(numBytes)].push_back(block);
+        freeLists.cachedBytes += classBytes;
+        cached = true;
+      }
+    }
+    if (!cached) {
+      ::operator delete(block);
+    }
+  }
+
+  /** Like new T[n], but from the pool. Free with deleteArray(array, n). **/
+  template<typename T>
+  T *newArray (int n) {
+    T *array = static_cast<T*>(allocate(n * sizeof(T)));
+    for (int i = 0; i < n; i++) {
+      new (&array[i]) T();
+    }
+    return array;
+  }
+
+  /** Like newArray, for buffers whose elements are all written before they are read (e.g.
+      by MPI, or by the threads of a parallel loop). Trivially default constructible
+      elements are left unconstructed, so the memory isn't touched until it is written,
+      and large blocks get their pages from the threads that write them. Other elements
+      are constructed in parallel. Free with deleteArray(array, n). **/
+  template<typename T>
+  T *allocateArray (int n) {
+    T *array = static_cast<T*>(allocate(n * sizeof(T)));
+    if (!is_trivially_default_constructible<T>::value) {
+      Scheduler::parallelFor(n, [array](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          new (&array[i]) T();
+        }
+      });
+    }
+    return array;
+  }
+
+  template<typename T>
+  void deleteArray (T *array, int n) {
+    if (array == NULL) {
+      return;
+    }
+    for (int i = 0; i < n; i++) {
+      array[i].~T();
+    }
+    release(array, n * sizeof(T));
+  }
+
+  /** Hands all the cached memory back to the heap **/
+  inline void clear () {
+    #pragma omp critical(pool)
+    {
+      FreeLists &freeLists = getFreeLists();
+      for (int sizeClass = 0; sizeClass < NUM_CLASSES; sizeClass++) {
+        for (size_t i = 0; i < freeLists.blocks[sizeClass].size(); i++) {
+          ::operator delete(freeLists.blocks[sizeClass][i]);
+        }
+        freeLists.blocks[sizeClass].clear();
+      }
+      freeLists.cachedBytes = 0;
+    }
+  }
+};
+
+#endif
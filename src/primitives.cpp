@@ -0,0 +1,580 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "primitives.h"
+
+#include "uber_sequence.h"
+#include "delayed_sequence.h"
+#include "nested_sequence.h"
+#include "cluster.h"
+
+/*
+ * Checks the UberSequence primitives against serial results, on sequences of about n
+ * elements: delayed pipelines, dynamic transforms, rebalancing, batched get and scatter,
+ * ordered and tuple reduces and scans, futures, filter, sort, zip, reduceByKey, segmented
+ * and nested operations, slices and root collection. Every node runs every check, and
+ * node 0 prints the results.
+ */
+
+static void report(const std::string &name, bool passed) {
+  if (Cluster::procId == 0) {
+    std::cout << "[" << (passed ? "PASS" : "FAIL") << "] " << name << std::endl;
+  }
+}
+
+/** True if every node's elements of seq are expected(index) **/
+template<typename T>
+static bool matches(UberSequence<T> &seq, std::function<T(int)> expected) {
+  int mismatches = 0;
+  for (int part = 0; part < seq.numParts; part++) {
+    SeqPart<T> &seqPart = seq.mySeqParts[part];
+    for (int i = 0; i < seqPart.numElements; i++) {
+      mismatches += !(seqPart.data[i] == expected(seqPart.startIndex + i));
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &mismatches, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  return mismatches == 0;
+}
+
+static void test_delayed(int n) {
+  // Each pipeline stage runs inside the consuming reduce, scan or force
+  UberSequence<int> a([](int i) { return i; }, n);
+  UberSequence<long> b([](int i) { return 3L * i; }, &a);
+  auto fused = delay(&a).map([](int x) { return 2L * x; }).zip(delay(&b),
+    [](long x, long y) { return x + y; });
+  bool passed = fused.reduce(Sum(), 1L) == 1 + 5L * n * (n - 1) / 2;
+
+  UberSequence<long> *scanned = fused.scan(Sum(), 0L);
+  passed = passed && scanned->hasSameLayout(&a) &&
+    matches<long>(*scanned, [](int i) { return 5L * i * (i + 1) / 2; });
+  UberSequence<long> *forced = fused.transform([](long x) { return x - 1; }).force();
+  passed = passed && forced->hasSameLayout(&a) &&
+    matches<long>(*forced, [](int i) { return 5L * i - 1; });
+  report("delayed zip/scan/force", passed);
+  delete scanned;
+  delete forced;
+}
+
+/** True if the nodes' parts hold n elements between them, in order of index **/
+template<typename T>
+static bool coversAll(UberSequence<T> &seq, int n) {
+  int myElements = 0;
+  int outOfOrder = 0;
+  for (int part = 0; part < seq.numParts; part++) {
+    myElements += seq.mySeqParts[part].numElements;
+    outOfOrder += part > 0 && seq.mySeqParts[part].startIndex <
+      seq.mySeqParts[part - 1].startIndex + seq.mySeqParts[part - 1].numElements;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &myElements, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &outOfOrder, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  return myElements == n && outOfOrder == 0;
+}
+
+static void test_dynamic(int n) {
+  // A few elements are much more expensive than the rest
+  auto uneven = [](int i) {
+    volatile long work = 0;
+    for (int k = 0; k < (i % 1000 < 50 ? 2000 : 0); k++) {
+      work += k;
+    }
+    return (long)i;
+  };
+  UberSequence<long> seq(uneven, n, DYNAMIC_BALANCING);
+  bool passed = coversAll(seq, n) && matches<long>(seq, [](int i) { return (long)i; });
+  seq.transform([&uneven](long x) { return uneven(x) * 2 + 1; }, DYNAMIC_BALANCING);
+  passed = passed && coversAll(seq, n) &&
+    matches<long>(seq, [](int i) { return 2L * i + 1; });
+  seq.scan(Sum(), 0L);
+  passed = passed && seq.get(n - 1) == (long)n * n;
+
+  // Parts claimed from a statically laid out sequence move to the node that claimed them
+  UberSequence<long> statically([](int i) { return (long)i; }, n);
+  statically.transform([&uneven](long x) { return -uneven(x); }, DYNAMIC_BALANCING);
+  passed = passed && coversAll(statically, n) &&
+    matches<long>(statically, [](int i) { return -(long)i; });
+  report("dynamic generate/transform", passed);
+}
+
+static void test_rebalance(int n) {
+  UberSequence<long> seq([](int i) { return (long)i; }, n);
+  std::vector<int> owners;
+  for (int block = 0; block < seq.numResponsibilities; block++) {
+    owners.push_back(seq.responsibilities[block].procId);
+  }
+
+  // Pretend node 0 is three times as fast as each of the others
+  std::vector<double> measured(Cluster::procSpeeds, Cluster::procSpeeds + Cluster::procs);
+  for (int procId = 0; procId < Cluster::procs; procId++) {
+    Cluster::procSpeeds[procId] = (procId == 0 ? 3.0 : 1.0) / (Cluster::procs + 2);
+  }
+  seq.rebalance();
+
+  // Blocks keep their owners, and each node's elements match its share
+  int misplaced = 0;
+  for (int block = 0; block < seq.numResponsibilities; block++) {
+    misplaced += seq.responsibilities[block].procId != owners[block];
+  }
+  int myElements = 0;
+  for (int part = 0; part < seq.numParts; part++) {
+    myElements += seq.mySeqParts[part].numElements;
+  }
+  double share = Cluster::procSpeeds[Cluster::procId] * n;
+  misplaced += std::abs(myElements - share) > seq.numResponsibilities + 1;
+  MPI_Allreduce(MPI_IN_PLACE, &misplaced, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  bool passed = misplaced == 0 && coversAll(seq, n) &&
+    matches<long>(seq, [](int i) { return (long)i; });
+  seq.scan(Sum(), 0L);
+  passed = passed && seq.get(n - 1) == (long)n * (n - 1) / 2;
+
+  // A sequence with views keeps its layout
+  UberSequence<char> layout;
+  layout.initializeLike(&seq);
+  UberSequence<long> *window = seq.slice(0, n / 2);
+  std::copy(measured.begin(), measured.end(), Cluster::procSpeeds);
+  seq.rebalance();
+  passed = passed && seq.hasSameLayout(&layout);
+  delete window;
+  report("rebalance", passed);
+}
+
+static void test_batched_get(int n) {
+  // Every node asks for its own indices, all over the sequence, out of order and with
+  // repeats. Node 1 asks for none, but still answers the others.
+  UberSequence<long> seq([](int i) { return 7L * i; }, n);
+  int count = Cluster::procId == 1 ? 0 : 1000 + Cluster::procId;
+  std::vector<int> indices(count);
+  for (int k = 0; k < count; k++) {
+    indices[k] = k % 10 == 0 ? n - 1 : (int)((k * 7919L + Cluster::procId * 31L) % n);
+  }
+  std::vector<long> values(count);
+  seq.get(indices.data(), count, values.data());
+  int mismatches = 0;
+  for (int k = 0; k < count; k++) {
+    mismatches += values[k] != 7L * indices[k];
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &mismatches, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  report("batched get", mismatches == 0);
+}
+
+static void test_scatter(int n) {
+  int procs = Cluster::procs;
+  UberSequence<long> seq([](int i) { return 0L; }, n);
+  seq.set(n / 3, 42);
+  bool passed = seq.get(n / 3) == 42;
+
+  // Node p sets the indices i = p (mod procs) in [1, n / 2) to 3i. Every node also sets
+  // index 0 twice, and the last update from the highest node is kept.
+  std::vector<int> indices;
+  std::vector<long> values;
+  for (int i = 1; i < n / 2; i++) {
+    if (i % procs == Cluster::procId) {
+      indices.push_back(i);
+      values.push_back(3L * i);
+    }
+  }
+  indices.push_back(0);
+  values.push_back(100L * Cluster::procId + 1);
+  indices.push_back(0);
+  values.push_back(100L * Cluster::procId + 2);
+  seq.scatter(indices.data(), values.data(), indices.size());
+  passed = passed && matches<long>(seq, [n, procs](int i) {
+    return i == 0 ? 100L * (procs - 1) + 2 : i < n / 2 ? 3L * i : 0L;
+  });
+
+  // A histogram: every node adds 1 to bin k % 50 for each k < 1000
+  int binWidth = n / 50;
+  std::vector<int> bins(1000);
+  std::vector<long> ones(1000, 1L);
+  for (int k = 0; k < 1000; k++) {
+    bins[k] = k % 50 * binWidth;
+  }
+  UberSequence<long> histogram([](int i) { return 0L; }, n);
+  histogram.scatter(bins.data(), ones.data(), bins.size(), Sum());
+  passed = passed && matches<long>(histogram, [binWidth, procs](int i) {
+    return i % binWidth == 0 && i / binWidth < 50 ? 20L * procs : 0L;
+  });
+
+  // Updates are merged in order of node: each node appends its digit to the last element
+  long digit = Cluster::procId + 1;
+  int last = n - 1;
+  histogram.scatterWith(&last, &digit, 1, [](long a, long b) { return a * 10 + b; });
+  long expected = 0;
+  for (int procId = 0; procId < procs; procId++) {
+    expected = expected * 10 + procId + 1;
+  }
+  passed = passed && histogram.get(n - 1) == expected;
+  report("set/scatter/scatterWith", passed);
+}
+
+/** x -> (first * x + second) mod AFFINE_MOD, which compose in order but don't commute **/
+typedef std::pair<long, long> Affine;
+static const long AFFINE_MOD = 1000000007;
+
+static Affine affineOf(int i) {
+  return Affine(i % 5 + 2, i % 7);
+}
+
+/** Applies a, then b **/
+static Affine compose(const Affine &a, const Affine &b) {
+  return Affine(b.first * a.first % AFFINE_MOD, (b.first * a.second + b.second) % AFFINE_MOD);
+}
+
+static void test_ordered_combine(int n) {
+  // The default layout spreads the blocks over the nodes at random, so with more than one
+  // node, combining in order takes each node's range of blocks (not rank contiguous)
+  UberSequence<Affine> seq(affineOf, n);
+  auto combiner = [](const Affine &a, const Affine &b) { return compose(a, b); };
+  std::vector<Affine> expected(n);
+  Affine scan(1, 0);
+  for (int i = 0; i < n; i++) {
+    scan = compose(scan, affineOf(i));
+    expected[i] = scan;
+  }
+  bool passed = seq.reduce(combiner, Affine(1, 0)) == expected[n - 1];
+  seq.scan(combiner, Affine(1, 0));
+  passed = passed && matches<Affine>(seq, [&](int i) { return expected[i]; });
+  report("ordered reduce/scan", passed);
+}
+
+static void test_futures(int n) {
+  // Start several operations on different sequences, then wait for them out of order
+  UberSequence<long> a([](int i) { return (long)i; }, n);
+  UberSequence<long> b([](int i) { return 1L; }, n);
+  UberSequence<Affine> c(affineOf, n);
+  auto combiner = [](const Affine &x, const Affine &y) { return compose(x, y); };
+  Future<long> sum = a.reduceAsync(Sum(), 0L);
+  Future<long> highest = a.reduceAsync(Max(), -1L);
+  Future<Affine> composed = c.reduceAsync(combiner, Affine(1, 0));
+  Future<void> counted = b.scanAsync(Sum(), 0L);
+  Future<long> element = a.getAsync(n / 2);
+
+  Affine expected(1, 0);
+  for (int i = 0; i < n; i++) {
+    expected = compose(expected, affineOf(i));
+  }
+  bool passed = element.get() == n / 2 && composed.get() == expected;
+  counted.get();
+  passed = passed && matches<long>(b, [](int i) { return i + 1L; }) &&
+    highest.get() == n - 1 && sum.get() == (long)n * (n - 1) / 2 && sum.test();
+  report("futures", passed);
+}
+
+static void test_tuple_reduce(int n) {
+  auto value = [n](int i) { return (int)((i * 7L) % n) - n / 2; };
+  int intMax = std::numeric_limits<int>::max();
+  int intMin = std::numeric_limits<int>::min();
+  int lowest = intMax, highest = intMin, lowestPrefix = intMax;
+  std::vector<int> prefixes(n);
+  for (int i = 0; i < n; i++) {
+    lowest = std::min(lowest, value(i));
+    highest = std::max(highest, value(i));
+    prefixes[i] = (i > 0 ? prefixes[i - 1] : 0) + value(i);
+    lowestPrefix = std::min(lowestPrefix, prefixes[i]);
+  }
+
+  UberSequence<int> seq(value, n);
+  std::tuple<int, int, int> reduced = seq.reduce(std::make_tuple(Min(), Max(), Sum()),
+    std::make_tuple(intMax, intMin, 0));
+  report("tuple reduce", reduced == std::make_tuple(lowest, highest, prefixes[n - 1]));
+
+  // The reduces see the prefix sums, as the scan writes them
+  std::tuple<int, int> sums = seq.scanAndReduce(Sum(), 0, std::make_tuple(Min(), Last()),
+    std::make_tuple(intMax, 0));
+  report("scan and reduce", sums == std::make_tuple(lowestPrefix, prefixes[n - 1]) &&
+    matches<int>(seq, [&prefixes](int i) { return prefixes[i]; }));
+}
+
+/** Elements of seq that this node holds **/
+template<typename T>
+static int myElementCount(UberSequence<T> &seq) {
+  int count = 0;
+  for (int part = 0; part < seq.numParts; part++) {
+    count += seq.mySeqParts[part].numElements;
+  }
+  return count;
+}
+
+static void test_filter(int n) {
+  UberSequence<int> seq([](int i) { return i; }, n);
+
+  // Every third element survives, spread like the source
+  UberSequence<int> *thirds = seq.filter([](int x) { return x % 3 == 0; });
+  bool passed = thirds->length() == (n + 2) / 3 && coversAll(*thirds, (n + 2) / 3) &&
+    matches<int>(*thirds, [](int i) { return 3 * i; });
+  report("filter", passed);
+
+  // Only the first quarter survives, so without balancing each node keeps just its own
+  // survivors, and with it no node holds much more than its share
+  int quarter = n / 4;
+  int mySurvivors = 0;
+  for (int part = 0; part < seq.numParts; part++) {
+    SeqPart<int> &seqPart = seq.mySeqParts[part];
+    mySurvivors += std::max(0, std::min(seqPart.numElements, quarter - seqPart.startIndex));
+  }
+  auto early = [quarter](int x) { return x < quarter; };
+  UberSequence<int> *kept = seq.filter(early, false);
+  UberSequence<int> *balanced = seq.filter(early);
+  int misplaced = myElementCount(*kept) != mySurvivors;
+  double share = ADJUST_WORK ? Cluster::procSpeeds[Cluster::procId] : 1.0 / Cluster::procs;
+  int overloaded = myElementCount(*balanced) > REBALANCE_THRESHOLD * share * quarter + 1;
+  MPI_Allreduce(MPI_IN_PLACE, &misplaced, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &overloaded, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  auto identity = [](int i) { return i; };
+  passed = misplaced == 0 && coversAll(*kept, quarter) && matches<int>(*kept, identity) &&
+    overloaded == 0 && coversAll(*balanced, quarter) && matches<int>(*balanced, identity);
+  report("filter (unbalanced)", passed);
+
+  // Nothing survives
+  UberSequence<int> *none = seq.filter([](int x) { return false; });
+  passed = none->length() == 0 && coversAll(*none, 0) && none->reduce(Sum(), 7) == 7;
+  report("filter (empty)", passed);
+
+  // Keeps a different value than it tests
+  SeqPart<int> *parts = seq.mySeqParts;
+  UberSequence<long> *loaded = seq.filterWith<long>([parts](int part, int i) {
+    return parts[part].data[i] % 2 == 1;
+  }, [parts](int part, int i) { return 10L * parts[part].data[i]; });
+  passed = loaded->length() == n / 2 &&
+    matches<long>(*loaded, [](int i) { return 10L * (2 * i + 1); });
+  report("filterWith", passed);
+
+  delete thirds;
+  delete kept;
+  delete balanced;
+  delete none;
+  delete loaded;
+}
+
+static void test_sort(int n) {
+  // Many duplicates, and a descending order
+  auto scrambled = [](int i) { return (int)((i * 2654435761u) % 1000); };
+  UberSequence<int> seq(scrambled, n);
+  seq.sort([](int a, int b) { return a < b; });
+  std::vector<int> expected(n);
+  for (int i = 0; i < n; i++) {
+    expected[i] = scrambled(i);
+  }
+  std::sort(expected.begin(), expected.end());
+  report("sort", seq.length() == n &&
+    matches<int>(seq, [&](int i) { return expected[i]; }));
+
+  seq.sort([](int a, int b) { return a > b; });
+  report("sort descending", matches<int>(seq, [&](int i) { return expected[n - 1 - i]; }));
+}
+
+static void test_zip(int n) {
+  UberSequence<int> a([](int i) { return i; }, n);
+  UberSequence<long> b([](int i) { return 3L * i; }, &a);
+  UberSequence<long> *sum = a.zipWith(&b, [](int x, long y) { return x + y; });
+  report("zipWith (same layout)", sum->hasSameLayout(&a) &&
+    matches<long>(*sum, [](int i) { return 4L * i; }));
+  delete sum;
+
+  // A sorted sequence has one block per node, so it has to be repartitioned first
+  UberSequence<double> c([n](int i) { return (double)(n - 1 - i); }, n);
+  c.sort([](double x, double y) { return x < y; });
+  UberSequence<long> *product = b.zipWith(&c, [](long x, double y) { return x * (long)y; });
+  report("zipWith (repartitioned)", product->length() == n &&
+    matches<long>(*product, [](int i) { return 3L * i * i; }));
+  delete product;
+}
+
+/** True if every node's elements of seq pass check(element) **/
+template<typename T>
+static bool allPass(UberSequence<T> &seq, std::function<bool(const T&)> check) {
+  int failures = 0;
+  for (int part = 0; part < seq.numParts; part++) {
+    for (int i = 0; i < seq.mySeqParts[part].numElements; i++) {
+      failures += !check(seq.mySeqParts[part].data[i]);
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &failures, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  return failures == 0;
+}
+
+static void test_reduce_by_key(int n) {
+  const int numKeys = 97;
+  UberSequence<int> seq([](int i) { return i; }, n);
+
+  // A histogram: key k counts the i < n with i % numKeys == k
+  UberSequence<pair<int, int> > *counts = seq.reduceByKey(
+    [](int x) { return x % numKeys; }, [](int x) { return 1; }, Sum());
+  report("reduceByKey (histogram)", counts->length() == numKeys &&
+    allPass<pair<int, int> >(*counts, [n](const pair<int, int> &entry) {
+      return entry.second == n / numKeys + (entry.first < n % numKeys);
+    }));
+  delete counts;
+
+  UberSequence<pair<int, int> > *maxes = seq.reduceByKey(
+    [](int x) { return x % numKeys; }, Max());
+  report("reduceByKey (elements)", maxes->length() == numKeys &&
+    allPass<pair<int, int> >(*maxes, [n](const pair<int, int> &entry) {
+      return entry.second == (n - 1 - entry.first) / numKeys * numKeys + entry.first;
+    }));
+  delete maxes;
+}
+
+static void test_segmented(int n) {
+  const int segmentLength = 10;
+
+  // Flags on their own layout, and on the sequence's
+  UberSequence<long> ones([](int i) { return 1L; }, n);
+  UberSequence<bool> flags([](int i) { return i % segmentLength == 0; }, n);
+  ones.segmentedScan(&flags, Sum(), 0L);
+  report("segmentedScan", matches<long>(ones, [](int i) { return i % segmentLength + 1L; }));
+
+  UberSequence<long> seq([](int i) { return (long)i; }, n);
+  UberSequence<bool> sameLayoutFlags([](int i) { return i % segmentLength == 0; }, &seq);
+  UberSequence<long> *sums = seq.segmentedReduce(&sameLayoutFlags, Sum(), 100L);
+  int numSegments = (n + segmentLength - 1) / segmentLength;
+  report("segmentedReduce", sums->length() == numSegments &&
+    matches<long>(*sums, [n](int segment) {
+      long sum = 100;
+      for (int i = segment * segmentLength; i < min(n, (segment + 1) * segmentLength); i++) {
+        sum += i;
+      }
+      return sum;
+    }));
+  delete sums;
+}
+
+static void test_nested(int n) {
+  // Inner sequence s holds s % 7 elements (some empty), with element j = s + j
+  int numSequences = n / 3;
+  auto lengthOf = [](int s) { return s % 7; };
+  NestedSequence<long> nested(lengthOf, [](int s, int j) { return (long)s + j; },
+    numSequences);
+  bool passed = nested.length() == numSequences && nested.get(9, 1) == 10;
+  NestedSequence<long> *doubled = nested.map([](long x) { return 2 * x; });
+  UberSequence<long> *sums = doubled->reduce(Sum(), 1L);
+  passed = passed && matches<long>(*sums, [](int s) {
+    long sum = 1;
+    for (int j = 0; j < s % 7; j++) {
+      sum += 2L * (s + j);
+    }
+    return sum;
+  });
+  doubled->scan(Sum(), 0L);
+  passed = passed && doubled->get(12, 4) == 2L * (12 + 13 + 14 + 15 + 16);
+  report("NestedSequence", passed);
+  delete sums;
+  delete doubled;
+
+  // No inner sequences, and only empty ones
+  NestedSequence<long> none([](int s) { return 1; }, [](int s, int j) { return 1L; }, 0);
+  UberSequence<long> *noneSums = none.reduce(Sum(), 0L);
+  bool emptyPassed = none.length() == 0 && none.totalLength() == 0 &&
+    noneSums->length() == 0;
+  NestedSequence<long> allEmpty([](int s) { return 0; }, [](int s, int j) { return 1L; },
+    numSequences);
+  UberSequence<long> *allEmptySums = allEmpty.reduce(Sum(), 5L);
+  allEmpty.scan(Sum(), 0L);
+  emptyPassed = emptyPassed && allEmpty.totalLength() == 0 &&
+    matches<long>(*allEmptySums, [](int s) { return 5L; });
+  report("NestedSequence (empty)", emptyPassed);
+  delete noneSums;
+  delete allEmptySums;
+}
+
+static void test_slice(int n) {
+  UberSequence<long> seq([](int i) { return (long)i; }, n);
+  int begin = n / 3;
+  int end = n - n / 5;
+  UberSequence<long> *window = seq.slice(begin, end);
+  long expected = (long)(end - 1) * end / 2 - (long)(begin - 1) * begin / 2;
+  bool passed = window->length() == end - begin && window->reduce(Sum(), 0L) == expected &&
+    window->get(0) == begin;
+
+  // Slices of slices, and writes through to the sliced sequence
+  UberSequence<long> *inner = window->slice(10, 20);
+  passed = passed && inner->reduce(Sum(), 0L) == 10L * begin + 145;
+  inner->transform([](long x) { return -x; });
+  passed = passed && seq.get(begin + 10) == -(begin + 10L) && seq.get(begin + 9) == begin + 9;
+  delete inner;
+  window->scan(Max(), 0L);
+  passed = passed && matches<long>(seq, [begin](int i) {
+    return i >= begin + 10 && i < begin + 20 ? begin + 9L : (long)i;
+  });
+  delete window;
+
+  // Sorting a view gives it its own copy, and leaves the sliced sequence as it was
+  UberSequence<long> *head = seq.slice(0, begin);
+  head->sort([](long a, long b) { return a > b; });
+  passed = passed && seq.numViews == 0 && head->get(0) == begin - 1 &&
+    matches<long>(*head, [begin](int i) { return begin - 1L - i; }) &&
+    matches<long>(seq, [begin](int i) {
+      return i >= begin + 10 && i < begin + 20 ? begin + 9L : (long)i;
+    });
+  delete head;
+  report("slice", passed);
+}
+
+/** Scatters an array of n ints from root, checks it, and gathers it back **/
+static bool scatterGathers(int n, int root) {
+  int *array = NULL;
+  if (Cluster::procId == root) {
+    array = Pool::newArray<int>(n);
+    for (int i = 0; i < n; i++) {
+      array[i] = 3 * i + 1;
+    }
+  }
+  UberSequence<int> seq(array, n, root);
+  bool passed = matches<int>(seq, [](int i) { return 3 * i + 1; });
+  if (Cluster::procId == root) {
+    std::fill(array, array + n, 0);
+  }
+  seq.transform([](int x) { return x - 1; });
+  seq.gather(array, root);
+  int mismatches = 0;
+  if (Cluster::procId == root) {
+    for (int i = 0; i < n; i++) {
+      mismatches += array[i] != 3 * i;
+    }
+  }
+
+  // Gathering a slice only copies the viewed elements
+  int begin = n / 4;
+  UberSequence<int> *window = seq.slice(begin, n / 2);
+  window->gather(array, root);
+  if (Cluster::procId == root) {
+    for (int i = 0; i < window->length(); i++) {
+      mismatches += array[i] != 3 * (begin + i);
+    }
+    Pool::deleteArray(array, n);
+  }
+  delete window;
+  MPI_Bcast(&mismatches, 1, MPI_INT, root, MPI_COMM_WORLD);
+  return passed && mismatches == 0;
+}
+
+static void test_root(int n) {
+  // Several chunks from the last node, and one from node 0
+  int chunked = 2 * (ROOT_CHUNK_BYTES / sizeof(int)) + 12345;
+  report("scatter/gather from root", scatterGathers(n, 0) &&
+    scatterGathers(chunked, Cluster::procs - 1));
+}
+
+void test_primitives(int n) {
+  test_delayed(n);
+  test_dynamic(n);
+  test_rebalance(n);
+  test_batched_get(n);
+  test_scatter(n);
+  test_ordered_combine(n);
+  test_futures(n);
+  test_tuple_reduce(n);
+  test_filter(n);
+  test_sort(n);
+  test_zip(n);
+  test_reduce_by_key(n);
+  test_segmented(n);
+  test_nested(n);
+  test_slice(n);
+  test_root(n);
+}
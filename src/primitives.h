@@ -0,0 +1,6 @@
+#ifndef _PRIMITIVES_H_
+#define _PRIMITIVES_H_
+
+void test_primitives(int n);
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <algorithm>
+#include <omp.h>
+
+using namespace std;
+
+/*
+ * Work stealing scheduler for the threads on a node
+ *
+ * A loop over [0, numElements) is cut into chunks of grainSize elements. Every
+ * thread starts with an equal, contiguous range of chunks in its own deque and
+ * takes chunks off the front of it. A thread that runs out of chunks steals the
+ * back half of another thread's remaining range, so threads that get cheap
+ * elements (e.g. pixels far from the Mandelbrot set) help out the others instead
+ * of waiting for the slowest one.
+ */
+namespace Scheduler {
+  const int MAX_GRAIN_SIZE = 1024;
+  const int CHUNKS_PER_THREAD = 64;
+
+  /** The chunks [begin, end) a thread hasn't run yet. Padded to avoid false sharing **/
+  struct WorkRange
+  {
+    omp_lock_t lock;
+    int begin;
+    int end;
+    char padding[64];
+  };
+
+  /** A grain size that gives each thread several chunks to steal, without making
+      chunks so small that taking them costs more than running them **/
+  inline int getGrainSize (int numElements) {
+    int numChunks = omp_get_max_threads() * CHUNKS_PER_THREAD;
+    return max(1, min(MAX_GRAIN_SIZE, numElements / numChunks));
+  }
+
+  /** Returns a range (with its lock) for each thread. They are made once and reused by
+      every loop, which only resets their bounds **/
+  inline WorkRange *getRanges (int numThreads) {
+    static WorkRange *ranges = NULL;
+    static int numRanges = 0;
+    if (numRanges < numThreads) {
+      for (int thread = 0; thread < numRanges; thread++) {
+        omp_destroy_lock(&ranges[thread].lock);
+      }
+      delete[] ranges;
+      ranges = new WorkRange[numThreads];
+      numRanges = numThreads;
+      for (int thread = 0; thread < numRanges; thread++) {
+        omp_init_lock(&ranges[thread].lock);
+      }
+    }
+    return ranges;
+  }
+
+  /** Takes the next chunk off the front of range. Returns false if range is empty **/
+  inline bool popFront (WorkRange *range, int *chunk) {
+    bool found = false;
+    omp_set_lock(&range->lock);
+    if (range->begin < range->end) {
+      *chunk = range->begin;
+      range->begin++;
+      found = true;
+    }
+    omp_unset_lock(&range->lock);
+    return found;
+  }
+
+  /** Moves the back half of some other thread's range into ranges[me].
+      Returns false if every other range is empty **/
+  inline bool steal (WorkRange *ranges, int numThreads, int me) {
+    for (int offset = 1; offset < numThreads; offset++) {
+      WorkRange *victim = &ranges[(me + offset) % numThreads];
+      int begin = 0, end = 0;
+      omp_set_lock(&victim->lock);
+      int remaining = victim->end - victim->begin;
+      if (remaining > 0) {
+        end = victim->end;
+        begin = end - (remaining + 1) / 2;
+        victim->end = begin;
+      }
+      omp_unset_lock(&victim->lock);
+
+      if (begin < end) {
+        omp_set_lock(&ranges[me].lock);
+        ranges[me].begin = begin;
+        ranges[me].end = end;
+        omp_unset_lock(&ranges[me].lock);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** Calls body(begin, end) for disjoint ranges covering [0, numElements), each at most
+      grainSize elements long and starting at a multiple of grainSize. Loops started from
+      inside a parallel region (which would share the ranges) run on the calling thread. **/
+  template<typename Body>
+  void parallelFor (int numElements, int grainSize, Body body) {
+    if (numElements <= 0) {
+      return;
+    }
+    int numChunks = (numElements + grainSize - 1) / grainSize;
+    if (omp_in_parallel()) {
+      for (int chunk = 0; chunk < numChunks; chunk++) {
+        body(chunk * grainSize, min(numElements, (chunk + 1) * grainSize));
+      }
+      return;
+    }
+    WorkRange *ranges = getRanges(omp_get_max_threads());
+    #pragma omp parallel
+    {
+      int numThreads = omp_get_num_threads();
+      int me = omp_get_thread_num();
+
+      // Start with an equal split of the chunks, like a static schedule would
+      int equalSplit = numChunks / numThreads;
+      int numLeftOverChunks = numChunks % numThreads;
+      int myLeftOver = me < numLeftOverChunks;
+      int begin = me * equalSplit + min(me, numLeftOverChunks);
+      ranges[me].begin = begin;
+      ranges[me].end = begin + equalSplit + myLeftOver;
+      #pragma omp barrier
+
+      int chunk;
+      do {
+        while (popFront(&ranges[me], &chunk)) {
+          body(chunk * grainSize, min(numElements, (chunk + 1) * grainSize));
+        }
+      } while (steal(ranges, numThreads, me));
+    }
+  }
+
+  template<typename Body>
+  void parallelFor (int numElements, Body body) {
+    parallelFor(numElements, getGrainSize(numElements), body);
+  }
+};
+
+#endif
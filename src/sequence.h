@@ -20,6 +20,8 @@ public:
   // Common information about the Sequence
   int size;
 
+  virtual ~Sequence () {}
+
   virtual void transform(function<T(T)> mapper) = 0;
 
   template<typename S>
@@ -0,0 +1,225 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <cstring>
+#include <type_traits>
+
+#include "combiners.h"
+
+using namespace std;
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define SIMD_DISPATCH true // GCC vector extensions, with a kernel per instruction set
+#endif
+
+/*
+ * SIMD reduce and scan kernels for the built in combiners (see combiners.h)
+ *
+ * The kernels are written once with GCC vector extensions, and built for AVX-512,
+ * AVX2 and SSE2. The widest one the cpu supports is picked when the program runs.
+ * Scans use an in-register prefix scan: a vector of lanes is combined with copies
+ * of itself shifted by 1, 2, 4, ... lanes, then with the carry from the previous
+ * vector. Other compilers and cpus get the scalar loops.
+ */
+namespace Simd {
+  /** True if reduces and scans of arrays of T with Combiner can use the vector kernels **/
+  template<typename T, typename Combiner>
+  struct Supported
+  {
+    static const bool value = CombinerTraits<Combiner>::builtin && !is_same<T, bool>::value &&
+      (is_integral<T>::value || is_same<T, float>::value || is_same<T, double>::value);
+  };
+
+  template<typename T, typename Combiner>
+  T reduceScalar (const T *data, int n, Combiner combiner) {
+    T value = data[0];
+    for (int i = 1; i < n; i++) {
+      value = combiner(value, data[i]);
+    }
+    return value;
+  }
+
+  template<typename T, typename Combiner>
+  void scanScalar (const T *in, T *out, int n, T init, Combiner combiner) {
+    T scan = init;
+    for (int i = 0; i < n; i++) {
+      scan = combiner(scan, in[i]);
+      out[i] = scan;
+    }
+  }
+
+#ifdef SIMD_DISPATCH
+  #define SIMD_INLINE inline __attribute__((always_inline))
+
+  /** A vector of Bytes / sizeof(T) lanes of T, and the matching vector of lane indices **/
+  template<typename T, int Bytes>
+  struct Vector
+  {
+    typedef T type __attribute__((vector_size(Bytes)));
+  };
+
+  template<int Size> struct LaneIndex;
+  template<> struct LaneIndex<1> { typedef signed char type; };
+  template<> struct LaneIndex<2> { typedef short type; };
+  template<> struct LaneIndex<4> { typedef int type; };
+  template<> struct LaneIndex<8> { typedef long long type; };
+
+  // a = a combined with b, lane by lane. Vectors are passed by reference, as their calling
+  // convention depends on the instruction set.
+  template<typename V> SIMD_INLINE void combine (Sum, V &a, const V &b) { a = a + b; }
+  template<typename V> SIMD_INLINE void combine (Min, V &a, const V &b) { a = a < b ? a : b; }
+  template<typename V> SIMD_INLINE void combine (Max, V &a, const V &b) { a = a < b ? b : a; }
+  template<typename V> SIMD_INLINE void combine (BitAnd, V &a, const V &b) { a = a & b; }
+  template<typename V> SIMD_INLINE void combine (BitOr, V &a, const V &b) { a = a | b; }
+  template<typename V> SIMD_INLINE void combine (BitXor, V &a, const V &b) { a = a ^ b; }
+
+  template<int Bytes, typename T, typename Combiner>
+  SIMD_INLINE T reduceLanes (const T *data, int n, Combiner combiner) {
+    typedef typename Vector<T, Bytes>::type Vec;
+    const int lanes = Bytes / sizeof(T);
+    const int unroll = 4; // Independent accumulators, to hide the latency of each combine
+    if (n < unroll * lanes) {
+      return reduceScalar(data, n, combiner);
+    }
+
+    Vec acc[unroll];
+    memcpy(acc, data, sizeof(acc));
+    int i = unroll * lanes;
+    for (; i + unroll * lanes <= n; i += unroll * lanes) {
+      Vec x[unroll];
+      memcpy(x, data + i, sizeof(x));
+      for (int u = 0; u < unroll; u++) {
+        combine(combiner, acc[u], x[u]);
+      }
+    }
+    for (int u = 1; u < unroll; u++) {
+      combine(combiner, acc[0], acc[u]);
+    }
+    T value = acc[0][0];
+    for (int lane = 1; lane < lanes; lane++) {
+      value = combiner(value, acc[0][lane]);
+    }
+    for (; i < n; i++) {
+      value = combiner(value, data[i]);
+    }
+    return value;
+  }
+
+  template<int Bytes, typename T, typename Combiner>
+  SIMD_INLINE void scanLanes (const T *in, T *out, int n, T init, Combiner combiner) {
+    typedef typename Vector<T, Bytes>::type Vec;
+    typedef typename Vector<typename LaneIndex<sizeof(T)>::type, Bytes>::type Mask;
+    const int lanes = Bytes / sizeof(T);
+
+    // shifts[k] moves lanes up by 2^k, filling in with the identity from the second operand
+    Vec identity;
+    Vec carry;
+    Mask shifts[8];
+    Mask last;
+    int numShifts = 0;
+    for (int lane = 0; lane < lanes; lane++) {
+      identity[lane] = Combiner::template identity<T>();
+      carry[lane] = init;
+      last[lane] = lanes - 1;
+    }
+    for (int shift = 1; shift < lanes; shift *= 2) {
+      for (int lane = 0; lane < lanes; lane++) {
+        shifts[numShifts][lane] = lane >= shift ? lane - shift : lanes + lane;
+      }
+      numShifts++;
+    }
+
+    int i = 0;
+    for (; i + lanes <= n; i += lanes) {
+      Vec x;
+      memcpy(&x, in + i, Bytes);
+      for (int k = 0; k < numShifts; k++) {
+        Vec shifted = __builtin_shuffle(x, identity, shifts[k]);
+        combine(combiner, x, shifted);
+      }
+      combine(combiner, x, carry); // The built in combiners are commutative
+      memcpy(out + i, &x, Bytes);
+      carry = __builtin_shuffle(x, last);
+    }
+    scanScalar(in + i, out + i, n - i, carry[0], combiner);
+  }
+
+  template<typename T, typename Combiner>
+  __attribute__((target("avx512f,avx512bw")))
+  T reduceAvx512 (const T *data, int n, Combiner combiner) {
+    return reduceLanes<64>(data, n, combiner);
+  }
+
+  template<typename T, typename Combiner>
+  __attribute__((target("avx2")))
+  T reduceAvx2 (const T *data, int n, Combiner combiner) {
+    return reduceLanes<32>(data, n, combiner);
+  }
+
+  template<typename T, typename Combiner>
+  T reduceSse2 (const T *data, int n, Combiner combiner) {
+    return reduceLanes<16>(data, n, combiner);
+  }
+
+  template<typename T, typename Combiner>
+  __attribute__((target("avx512f,avx512bw")))
+  void scanAvx512 (const T *in, T *out, int n, T init, Combiner combiner) {
+    scanLanes<64>(in, out, n, init, combiner);
+  }
+
+  template<typename T, typename Combiner>
+  __attribute__((target("avx2")))
+  void scanAvx2 (const T *in, T *out, int n, T init, Combiner combiner) {
+    scanLanes<32>(in, out, n, init, combiner);
+  }
+
+  template<typename T, typename Combiner>
+  void scanSse2 (const T *in, T *out, int n, T init, Combiner combiner) {
+    scanLanes<16>(in, out, n, init, combiner);
+  }
+
+  enum Level { SSE2, AVX2, AVX512 };
+
+  /** The widest instruction set this cpu supports, found once **/
+  inline Level getLevel () {
+    static Level level = __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") ? AVX512 :
+      __builtin_cpu_supports("avx2") ? AVX2 : SSE2;
+    return level;
+  }
+
+  /** Reduces data[0..n) (n >= 1) **/
+  template<typename T, typename Combiner>
+  T reduce (const T *data, int n, Combiner combiner) {
+    switch (getLevel()) {
+      case AVX512: return reduceAvx512(data, n, combiner);
+      case AVX2: return reduceAvx2(data, n, combiner);
+      default: return reduceSse2(data, n, combiner);
+    }
+  }
+
+  /** out[i] = init combined with in[0..i]. in and out may be the same array. **/
+  template<typename T, typename Combiner>
+  void scan (const T *in, T *out, int n, T init, Combiner combiner) {
+    switch (getLevel()) {
+      case AVX512: scanAvx512(in, out, n, init, combiner); break;
+      case AVX2: scanAvx2(in, out, n, init, combiner); break;
+      default: scanSse2(in, out, n, init, combiner); break;
+    }
+  }
+
+  #undef SIMD_INLINE
+#else
+  template<typename T, typename Combiner>
+  T reduce (const T *data, int n, Combiner combiner) {
+    return reduceScalar(data, n, combiner);
+  }
+
+  template<typename T, typename Combiner>
+  void scan (const T *in, T *out, int n, T init, Combiner combiner) {
+    scanScalar(in, out, n, init, combiner);
+  }
+#endif
+};
+
+#endif
@@ -3,18 +3,41 @@
 
 #include <algorithm>
 #include <iostream>
+#include <vector>
 #include <cassert>
 #include <ctime>
+#include <new>
+#include <type_traits>
 #include <mpi.h>
 #include <omp.h>
 
 #include "sequence.h"
 #include "cluster.h"
+#include "kernels.h"
+#include "pool.h"
+#include "combiners.h"
+#include "exchange.h"
+#include "future.h"
+#include "key_table.h"
+#include "CycleTimer.h"
 
 using namespace std;
 
 #define RANDOMIZE_WORK true // Randomly allocated blocks to nodes (instead of interleaving)
 #define ADJUST_WORK true // Gives faster nodes more work
+#define DYNAMIC_BLOCK_SCALE 4 // Dynamic balancing uses this many times more (smaller) blocks
+#define REBALANCE_WORK true // Measures node speeds, and lets sequences rebalance to fit them
+#define BALANCE_CHECK_INTERVAL 8 // Number of reduces/scans between balance checks
+#define REBALANCE_THRESHOLD 1.25 // Rebalance if the slowest node takes this much above average
+#define SORT_SAMPLES_PER_PROC 64 // Splitter candidates sort samples for each node in the cluster
+#define ROOT_CHUNK_BYTES (1 << 22) // Scattering from and gathering to a root moves this much at a time
+
+/** How an operation spreads its blocks over the cluster **/
+enum Balancing
+{
+  STATIC_BALANCING, // Blocks are assigned up front (see computeResponsibilities)
+  DYNAMIC_BALANCING // Nodes claim blocks while running, so faster nodes end up with more
+};
 
 /** Used to store which parts of the sequence each node in the cluster is responsible for **/
 struct Responsibility
@@ -33,6 +56,175 @@ struct SeqPart
   T* data;
 };
 
+/** Loads element i of sequence part 'part' **/
+template<typename T>
+struct PartLoader
+{
+  SeqPart<T> *parts;
+  PartLoader (SeqPart<T> *parts) : parts(parts) {}
+  T operator() (int part, int i) const {
+    return parts[part].data[i];
+  }
+  T *getPart (int part) const {
+    return parts[part].data;
+  }
+};
+
+template<typename T>
+struct ContiguousParts<PartLoader<T> >
+{
+  static const bool value = true;
+  typedef T Element;
+};
+
+/** Stores value as element i of sequence part 'part' **/
+template<typename T>
+struct PartStorer
+{
+  SeqPart<T> *parts;
+  PartStorer (SeqPart<T> *parts) : parts(parts) {}
+  void operator() (int part, int i, const T &value) const {
+    parts[part].data[i] = value;
+  }
+  T *getPart (int part) const {
+    return parts[part].data;
+  }
+};
+
+template<typename T>
+struct ContiguousParts<PartStorer<T> >
+{
+  static const bool value = true;
+  typedef T Element;
+};
+
+/** Loads element i of part 'part' through loader, as a tuple with a copy for each of
+    the combiners of a TupleCombiner **/
+template<typename Loader, typename... Rs>
+struct TupleLoader
+{
+  Loader loader;
+  TupleLoader (Loader loader) : loader(loader) {}
+  tuple<Rs...> operator() (int part, int i) const {
+    auto value = loader(part, i);
+    return tuple<Rs...>(Rs(value)...);
+  }
+};
+
+/** A node's combined value for reduce and scan collectives. Nodes that hold no blocks
+    contribute nothing (present is false). **/
+template<typename R>
+struct NodeReduce
+{
+  R value;
+  int present;
+};
+
+/** MPI's predefined datatype for T, where it has one **/
+template<typename T>
+struct MpiType
+{
+  static const bool exists = false;
+  static MPI_Datatype get () { return MPI_DATATYPE_NULL; }
+};
+
+#define MPI_TYPE(T, datatype)                           \
+  template<>                                            \
+  struct MpiType<T>                                     \
+  {                                                     \
+    static const bool exists = true;                    \
+    static MPI_Datatype get () { return datatype; }     \
+  };
+
+// Reduction operations aren't defined on MPI_CHAR, so char is the signed or unsigned one
+MPI_TYPE(char, (is_signed<char>::value ? MPI_SIGNED_CHAR : MPI_UNSIGNED_CHAR))
+MPI_TYPE(signed char, MPI_SIGNED_CHAR)
+MPI_TYPE(short, MPI_SHORT)
+MPI_TYPE(int, MPI_INT)
+MPI_TYPE(long, MPI_LONG)
+MPI_TYPE(long long, MPI_LONG_LONG)
+MPI_TYPE(unsigned char, MPI_UNSIGNED_CHAR)
+MPI_TYPE(unsigned short, MPI_UNSIGNED_SHORT)
+MPI_TYPE(unsigned, MPI_UNSIGNED)
+MPI_TYPE(unsigned long, MPI_UNSIGNED_LONG)
+MPI_TYPE(unsigned long long, MPI_UNSIGNED_LONG_LONG)
+MPI_TYPE(float, MPI_FLOAT)
+MPI_TYPE(double, MPI_DOUBLE)
+
+#undef MPI_TYPE
+
+/** MPI's predefined operation for each built in combiner (see combiners.h) **/
+template<typename Combiner>
+struct MpiOp
+{
+  static MPI_Op get () { return MPI_OP_NULL; }
+};
+
+template<> struct MpiOp<Sum> { static MPI_Op get () { return MPI_SUM; } };
+template<> struct MpiOp<Min> { static MPI_Op get () { return MPI_MIN; } };
+template<> struct MpiOp<Max> { static MPI_Op get () { return MPI_MAX; } };
+template<> struct MpiOp<BitAnd> { static MPI_Op get () { return MPI_BAND; } };
+template<> struct MpiOp<BitOr> { static MPI_Op get () { return MPI_BOR; } };
+template<> struct MpiOp<BitXor> { static MPI_Op get () { return MPI_BXOR; } };
+
+/** True if R and Combiner map onto MPI's predefined datatypes and operations **/
+template<typename R, typename Combiner>
+struct UseMpiOp : integral_constant<bool, CombinerTraits<Combiner>::builtin &&
+  MpiType<R>::exists> {};
+
+/** Every block's partial reduce on its way to every node (see startPartialReduces) **/
+template<typename R>
+struct PartialReduceExchange
+{
+  int totalBlocks;
+  int *owners; // Each block's procId, kept in case the layout changes before it's finished
+  R *recvbuf;
+  int *recvcounts; // Note, this is in BYTES
+  int *displs; // Note, this is in BYTES
+};
+
+/** Lets MPI combine NodeReduces with a combiner. MPI only takes plain function pointers, so
+    the combiner of the collective in progress is kept in a static. **/
+template<typename R, typename Combiner>
+struct CombinerOp
+{
+  static Combiner *combiner;
+
+  /** inout = in combined with inout, where in comes from the lower ranked node **/
+  static void apply (void *in, void *inout, int *len, MPI_Datatype *datatype) {
+    NodeReduce<R> *as = static_cast<NodeReduce<R>*>(in);
+    NodeReduce<R> *bs = static_cast<NodeReduce<R>*>(inout);
+    for (int i = 0; i < *len; i++) {
+      if (as[i].present && bs[i].present) {
+        bs[i].value = (*combiner)(as[i].value, bs[i].value);
+      } else if (as[i].present) {
+        bs[i] = as[i];
+      }
+    }
+  }
+
+  /** Created once per type of combiner, and kept until MPI_Finalize **/
+  static MPI_Op getOp () {
+    static MPI_Op op = MPI_OP_NULL;
+    if (op == MPI_OP_NULL) {
+      MPI_Op_create(apply, CombinerTraits<Combiner>::commutative, &op);
+    }
+    return op;
+  }
+
+  static MPI_Datatype getDatatype () {
+    static MPI_Datatype datatype = MPI_DATATYPE_NULL;
+    if (datatype == MPI_DATATYPE_NULL) {
+      MPI_Type_contiguous(sizeof(NodeReduce<R>), MPI_BYTE, &datatype);
+      MPI_Type_commit(&datatype);
+    }
+    return datatype;
+  }
+};
+
+template<typename R, typename Combiner>
+Combiner *CombinerOp<R, Combiner>::combiner = NULL;
+
 /** This is an uber sequence **/
 template<typename T>
 class UberSequence : public Sequence<T>
@@ -42,17 +234,72 @@ public:
   Responsibility *responsibilities;
   int numParts;
   SeqPart<T> *mySeqParts;
-  int numThreadBlocks;
+
+  // Local work measured since the last balance check (see checkBalance)
+  double workSeconds = 0;
+  double workElements = 0;
+  int opsSinceBalanceCheck = 0;
+
+  // Set to let balance checks move the data when the layout no longer fits the measured
+  // speeds. Only for sequences that share their layout with nothing (zip partners made with
+  // the layout constructor, delayed pipelines, views), since the old parts are freed.
+  bool autoRebalance = false;
+
+  // Scratch that depends only on the layout of mySeqParts, so is kept between operations
+  // (see getPartOffsets, getTiles, getChainedTiles and getPartWindows)
+  int *partOffsets = NULL;
+  vector<Kernels::Tile> tiles;
+  vector<Kernels::Tile> chainedTiles;
+  vector<MPI_Win> partWindows;
+
+  // Views (see slice) point into the parts of the sequence that owns the data, which keeps
+  // its layout while it has views
+  UberSequence<T> *viewed = NULL; // The sequence this one is a view of, or NULL if it owns its data
+  int numViews = 0;
+
+  /** Makes the sizes of the blocks add up to the size of the sequence, keeping every block
+      at least one element long **/
+  void fitBlocksToSize (Responsibility *blocks, int totalBlocks) {
+    int elementsCovered = 0;
+    for (int block = 0; block < totalBlocks; block++) {
+      // For correctness, some functions require that every block has one element
+      if (blocks[block].numElements < 1) {
+        blocks[block].numElements = 1;
+      }
+      elementsCovered += blocks[block].numElements;
+    }
+    int elementsLeft = this->size - elementsCovered;
+
+    // Make sure the blocks sum up to the total size
+    int block = 0;
+    while (elementsLeft > 0) {
+      blocks[block].numElements++;
+      block = (block + 1) % totalBlocks;
+      elementsLeft--;
+    }
+    while (elementsLeft < 0) {
+      if (blocks[block].numElements > 1) {
+        blocks[block].numElements--;
+        elementsLeft++;
+      }
+      block = (block + 1) % totalBlocks;
+    }
+  }
 
   /** Figure out which nodes are responsible for which parts of the sequence **/
   void computeResponsibilities () {
+    this->responsibilities = makeResponsibilities(&this->numResponsibilities);
+  }
+
+  /** Returns the layout a new sequence of this->size elements gets, and its number of
+      blocks in numBlocks. Collective when RANDOMIZE_WORK is on. **/
+  Responsibility *makeResponsibilities (int *numBlocks) {
     int totalBlocks = Cluster::blocksPerProc * Cluster::procs;
-    this->numResponsibilities = totalBlocks;
-    this->numParts = Cluster::blocksPerProc;
-    this->responsibilities = new Responsibility[totalBlocks];
+    *numBlocks = totalBlocks;
+    Responsibility *blocks = Pool::newArray<Responsibility>(totalBlocks);
 
     // Interleave blocks amongst nodes
-    int *partToNodeMap = new int[totalBlocks];
+    int *partToNodeMap = Pool::newArray<int>(totalBlocks);
     for (int part = 0; part < totalBlocks; part++) {
       partToNodeMap[part] = part % Cluster::procs;
     }
@@ -75,39 +322,18 @@ public:
 
     // Determine the sizes of the responsibilities
     if (ADJUST_WORK) {
-      int elementsCovered = 0;
       for (int block = 0; block < totalBlocks; block++) {
         int procId = partToNodeMap[block];
-        this->responsibilities[block].numElements = (Cluster::procTimes[procId] * this->size) / 
-          (Cluster::blocksPerProc * Cluster::systemTime);
-        // For correctness, some functions require that every block has one element
-        if (this->responsibilities[block].numElements < 1) {
-          this->responsibilities[block].numElements = 1;
-        }
-        elementsCovered += this->responsibilities[block].numElements;
-      }
-      int elementsLeft = this->size - elementsCovered;
-
-      // Make sure the blocks sum up to the total size
-      int block = 0;
-      while (elementsLeft > 0) {
-        this->responsibilities[block].numElements++;
-        block = (block + 1) % totalBlocks;
-        elementsLeft--;
-      }
-      while (elementsLeft < 0) {
-        if (this->responsibilities[block].numElements > 1) {
-          this->responsibilities[block].numElements--;
-          elementsLeft++;
-        }
-        block = (block + 1) % totalBlocks;
+        blocks[block].numElements = int(Cluster::procSpeeds[procId] *
+          this->size / Cluster::blocksPerProc);
       }
+      fitBlocksToSize(blocks, totalBlocks);
     } else {
       int blockSize = this->size / totalBlocks;
       int numLeftOverElements = this->size % totalBlocks;
       for (int block = 0; block < totalBlocks; block++) {
         int procId = partToNodeMap[block];
-        this->responsibilities[block].numElements = (block < numLeftOverElements ? 
+        blocks[block].numElements = (block < numLeftOverElements ? 
           blockSize + 1 : blockSize);
       }
     }
@@ -115,235 +341,1005 @@ public:
     // Assign responsibilities
     int curStartIndex = 0;
     for (int block = 0; block < totalBlocks; block++) {
-      this->responsibilities[block].procId = partToNodeMap[block];
-      this->responsibilities[block].startIndex = curStartIndex;
-      curStartIndex += this->responsibilities[block].numElements;
-      if (this->responsibilities[block].numElements < 1) {
+      blocks[block].procId = partToNodeMap[block];
+      blocks[block].startIndex = curStartIndex;
+      curStartIndex += blocks[block].numElements;
+      if (blocks[block].numElements < 1) {
         cout << "Warning: Sequence library not verified for small sequences." << endl;
       }
     }
 
     // Clean up
-    delete[] partToNodeMap;
+    Pool::deleteArray(partToNodeMap, totalBlocks);
+    return blocks;
   }
 
   /** Allocate sequence parts based on the work that has been assigned to the current node **/
   void allocateSeqParts () {
+    clearPartScratch();
+    this->numParts = 0;
+    for (int i = 0; i < this->numResponsibilities; i++) {
+      if (this->responsibilities[i].procId == Cluster::procId) {
+        this->numParts++;
+      }
+    }
+
     int curPart = 0;
-    this->mySeqParts = new SeqPart<T>[this->numParts];
+    this->mySeqParts = Pool::newArray<SeqPart<T> >(this->numParts);
     for (int i = 0; i < this->numResponsibilities; i++) {
       if (this->responsibilities[i].procId != Cluster::procId) {
       } else {
         int numElements = this->responsibilities[i].numElements;
         this->mySeqParts[curPart].startIndex = this->responsibilities[i].startIndex;
         this->mySeqParts[curPart].numElements = numElements;
-        this->mySeqParts[curPart].data = new T[numElements];
+        this->mySeqParts[curPart].data = allocatePartData(numElements);
         curPart++;
       }
     }
+
+    // Pages live on the NUMA node of the thread that first touches them, so construct the
+    // elements with the same threads (and ranges) that operators will use them with
+    SeqPart<T> *parts = this->mySeqParts;
+    Kernels::forEachElement(this->numParts, getPartOffsets(), [parts](int part, int i) {
+      new (&parts[part].data[i]) T();
+    });
+  }
+
+  /** Allocates the data for a sequence part without constructing (and so touching) it **/
+  static T *allocatePartData (int numElements) {
+    return static_cast<T*>(Pool::allocate(numElements * sizeof(T)));
+  }
+
+  /** Constructs part data in parallel, so that its pages go to the threads that use it **/
+  static void constructPartData (T *data, int numElements) {
+    Scheduler::parallelFor(numElements, [data](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        new (&data[i]) T();
+      }
+    });
+  }
+
+  static void freePartData (T *data, int numElements) {
+    for (int i = 0; i < numElements; i++) {
+      data[i].~T();
+    }
+    Pool::release(data, numElements * sizeof(T));
   }
 
   void initialize (int n) {
     this->size = n;
-    this->numThreadBlocks = Cluster::threadsPerProc;
     computeResponsibilities();
     allocateSeqParts();
   }
 
-  void destroy () {
-    for (int i = 0; i < this->numParts; i++) {
-      delete[] this->mySeqParts[i].data;
+  /** Adds to the local work measured since the last balance check **/
+  void recordWork (int numElements, double seconds) {
+    this->workElements += numElements;
+    this->workSeconds += seconds;
+  }
+
+  /** Called by every node after each reduce and scan (which all nodes run in the same
+      order), so that every node checks the balance at the same time **/
+  void countBalancedOp () {
+    this->opsSinceBalanceCheck++;
+    if (REBALANCE_WORK && this->opsSinceBalanceCheck >= BALANCE_CHECK_INTERVAL) {
+      checkBalance();
     }
-    delete[] this->mySeqParts;
-    delete[] this->responsibilities;
   }
 
-  /** Find which node has the element indexed by 'index' **/
-  int getNodeWithData (int index) {
-    // Get the node for the index
-    int nodeWithIndex = 0;
-    int totalBlocks = Cluster::procs * Cluster::blocksPerProc;
+  /** Feeds the measured work into Cluster::procSpeeds (which new sequences are laid out
+      by), and rebalances if the slowest node has been taking too long and autoRebalance
+      is set **/
+  void checkBalance () {
+    double imbalance = Cluster::updateProcSpeeds(this->workElements, this->workSeconds);
+    this->workElements = 0;
+    this->workSeconds = 0;
+    this->opsSinceBalanceCheck = 0;
+    if (this->autoRebalance && imbalance > REBALANCE_THRESHOLD) {
+      rebalance();
+    }
+  }
+
+  /** Resizes the blocks (keeping their owners) so that each node's share of the elements
+      matches its share of Cluster::procSpeeds, then moves the data to match. Collective.
+      Call it (or set autoRebalance) once the measured speeds have drifted from the ones
+      the sequence was laid out by (see README). Afterwards the sequence no longer has the
+      layout of the sequences it shared one with, and loaders over its old parts (e.g.
+      delayed pipelines) must not be used. Views and sequences with views keep their
+      layout. **/
+  void rebalance () {
+    if (this->size < this->numResponsibilities || this->viewed != NULL || this->numViews > 0) {
+      return;
+    }
+    int *procBlocks = Pool::newArray<int>(Cluster::procs);
+    fill(procBlocks, procBlocks + Cluster::procs, 0);
+    for (int block = 0; block < this->numResponsibilities; block++) {
+      procBlocks[this->responsibilities[block].procId]++;
+    }
+
+    Responsibility *newResponsibilities = Pool::newArray<Responsibility>(this->numResponsibilities);
+    for (int block = 0; block < this->numResponsibilities; block++) {
+      int procId = this->responsibilities[block].procId;
+      newResponsibilities[block].procId = procId;
+      newResponsibilities[block].numElements = int(Cluster::procSpeeds[procId] * this->size /
+        procBlocks[procId]);
+    }
+    fitBlocksToSize(newResponsibilities, this->numResponsibilities);
+    int curStartIndex = 0;
+    for (int block = 0; block < this->numResponsibilities; block++) {
+      newResponsibilities[block].startIndex = curStartIndex;
+      curStartIndex += newResponsibilities[block].numElements;
+    }
+
+    redistribute(newResponsibilities, this->numResponsibilities);
+    Pool::deleteArray(procBlocks, Cluster::procs);
+  }
+
+  /** Moves the data to the layout a new sequence of this size would get, if some node
+      holds more than REBALANCE_THRESHOLD times its share (by Cluster::procSpeeds) of the
+      elements. Used after operations like filter that change how many elements each
+      node holds. Sequences with views keep their layout. **/
+  void balanceLayout () {
+    int totalBlocks = Cluster::blocksPerProc * Cluster::procs;
+    if (this->size < totalBlocks || this->numViews > 0) {
+      return;
+    }
+    double *procElements = Pool::newArray<double>(Cluster::procs);
+    for (int block = 0; block < this->numResponsibilities; block++) {
+      procElements[this->responsibilities[block].procId] +=
+        this->responsibilities[block].numElements;
+    }
+    double imbalance = 0;
+    for (int procId = 0; procId < Cluster::procs; procId++) {
+      double share = ADJUST_WORK ? Cluster::procSpeeds[procId] : 1.0 / Cluster::procs;
+      imbalance = max(imbalance, procElements[procId] / (share * this->size));
+    }
+    Pool::deleteArray(procElements, Cluster::procs);
+    if (imbalance > REBALANCE_THRESHOLD) {
+      int numNewResponsibilities;
+      Responsibility *newResponsibilities = makeResponsibilities(&numNewResponsibilities);
+      redistribute(newResponsibilities, numNewResponsibilities);
+    }
+  }
+
+  /** Calls f(a, b, startIndex, numElements) for every overlap between a block in 'as' and a
+      block in 'bs', in order of index. Both lists must be in order of startIndex. **/
+  template<typename F>
+  static void forEachOverlap (vector<Responsibility> &as, vector<Responsibility> &bs, F f) {
+    size_t a = 0;
+    size_t b = 0;
+    while (a < as.size() && b < bs.size()) {
+      int aEnd = as[a].startIndex + as[a].numElements;
+      int bEnd = bs[b].startIndex + bs[b].numElements;
+      int startIndex = max(as[a].startIndex, bs[b].startIndex);
+      int endIndex = min(aEnd, bEnd);
+      if (startIndex < endIndex) {
+        f(a, b, startIndex, endIndex - startIndex);
+      }
+      if (aEnd <= bEnd) {
+        a++;
+      } else {
+        b++;
+      }
+    }
+  }
+
+  /** Moves the data (with one MPI_Alltoallv) so that the sequence is laid out as in
+      newResponsibilities, which the sequence takes ownership of **/
+  void redistribute (Responsibility *newResponsibilities, int numNewResponsibilities) {
+    assert(this->numViews == 0); // The views point into the parts freed below
+    SeqPart<T> *oldSeqParts = this->mySeqParts;
+    int oldNumParts = this->numParts;
+    Responsibility *oldResponsibilities = this->responsibilities;
+    int numOldResponsibilities = this->numResponsibilities;
+    this->responsibilities = newResponsibilities;
+    this->numResponsibilities = numNewResponsibilities;
+    allocateSeqParts();
+    exchangeParts(oldResponsibilities, numOldResponsibilities, oldSeqParts,
+      newResponsibilities, numNewResponsibilities, this->mySeqParts);
+
+    if (this->viewed != NULL) {
+      releaseViewed();
+    } else {
+      for (int part = 0; part < oldNumParts; part++) {
+        freePartData(oldSeqParts[part].data, oldSeqParts[part].numElements);
+      }
+    }
+    Pool::deleteArray(oldSeqParts, oldNumParts);
+    Pool::deleteArray(oldResponsibilities, numOldResponsibilities);
+  }
+
+  /** Copies the elements in oldSeqParts, laid out as in oldResponsibilities, into newSeqParts,
+      laid out as in newResponsibilities, with one MPI_Alltoallv. Both layouts cover the
+      same elements, and all nodes know both. **/
+  static void exchangeParts (Responsibility *oldResponsibilities, int numOldResponsibilities,
+                             SeqPart<T> *oldSeqParts, Responsibility *newResponsibilities,
+                             int numNewResponsibilities, SeqPart<T> *newSeqParts) {
+    // Which blocks each node has before and after
+    vector<vector<Responsibility> > oldBlocks(Cluster::procs);
+    vector<vector<Responsibility> > newBlocks(Cluster::procs);
+    for (int i = 0; i < numOldResponsibilities; i++) {
+      oldBlocks[oldResponsibilities[i].procId].push_back(oldResponsibilities[i]);
+    }
+    for (int i = 0; i < numNewResponsibilities; i++) {
+      newBlocks[newResponsibilities[i].procId].push_back(newResponsibilities[i]);
+    }
+
+    // Both sides know both layouts, so the counts can be computed locally.
+    // Data between two nodes is sent in order of index.
+    int procs = Cluster::procs;
+    int *sendcounts = Pool::newArray<int>(procs);
+    int *sdispls = Pool::newArray<int>(procs);
+    int *recvcounts = Pool::newArray<int>(procs);
+    int *rdispls = Pool::newArray<int>(procs);
+    vector<Responsibility> &mine = oldBlocks[Cluster::procId];
+    vector<Responsibility> &mineAfter = newBlocks[Cluster::procId];
+    for (int procId = 0; procId < procs; procId++) {
+      forEachOverlap(mine, newBlocks[procId], [&](int a, int b, int start, int count) {
+        sendcounts[procId] += count;
+      });
+      forEachOverlap(oldBlocks[procId], mineAfter, [&](int a, int b, int start, int count) {
+        recvcounts[procId] += count;
+      });
+    }
+    int sendTotal = Exchange::getDispls(sendcounts, sdispls);
+    int recvTotal = Exchange::getDispls(recvcounts, rdispls);
+
+    // Pack, exchange, unpack
+    T *sendbuf = Pool::allocateArray<T>(sendTotal);
+    for (int procId = 0; procId < procs; procId++) {
+      T *out = sendbuf + sdispls[procId];
+      forEachOverlap(mine, newBlocks[procId], [&](int a, int b, int start, int count) {
+        T *in = oldSeqParts[a].data + (start - oldSeqParts[a].startIndex);
+        copy(in, in + count, out);
+        out += count;
+      });
+    }
+    T *recvbuf = Exchange::alltoallv(sendbuf, sendcounts, recvcounts);
+    for (int procId = 0; procId < procs; procId++) {
+      T *in = recvbuf + rdispls[procId];
+      forEachOverlap(oldBlocks[procId], mineAfter, [&](int a, int b, int start, int count) {
+        copy(in, in + count, newSeqParts[b].data + (start - newSeqParts[b].startIndex));
+        in += count;
+      });
+    }
+
+    // Clean up
+    Pool::deleteArray(sendbuf, sendTotal);
+    Pool::deleteArray(recvbuf, recvTotal);
+    Pool::deleteArray(sendcounts, procs);
+    Pool::deleteArray(sdispls, procs);
+    Pool::deleteArray(recvcounts, procs);
+    Pool::deleteArray(rdispls, procs);
+  }
+
+  /** Replaces mySeqParts with 'parts', in order of startIndex **/
+  void setMySeqParts (vector<SeqPart<T> > &parts) {
+    std::sort(parts.begin(), parts.end(), [](const SeqPart<T> &a, const SeqPart<T> &b) {
+      return a.startIndex < b.startIndex;
+    });
+    clearPartScratch();
+    this->numParts = parts.size();
+    this->mySeqParts = Pool::newArray<SeqPart<T> >(this->numParts);
+    copy(parts.begin(), parts.end(), this->mySeqParts);
+  }
+
+  /** Every node passes in the blocks (indices into responsibilities) it now holds.
+      Updates responsibilities to match on every node. **/
+  void updateOwners (vector<int> &myBlocks) {
+    int *owners = Pool::newArray<int>(this->numResponsibilities);
+    fill(owners, owners + this->numResponsibilities, -1);
+    for (size_t i = 0; i < myBlocks.size(); i++) {
+      owners[myBlocks[i]] = Cluster::procId;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, owners, this->numResponsibilities, MPI_INT, MPI_MAX,
+      MPI_COMM_WORLD);
+    for (int i = 0; i < this->numResponsibilities; i++) {
+      this->responsibilities[i].procId = owners[i];
+    }
+    Pool::deleteArray(owners, this->numResponsibilities);
+  }
+
+  /** Like initialize followed by generate, except that the sequence is cut into many equal
+      blocks that nodes claim from a counter on node 0 (with MPI atomics) as they go.
+      Nodes that get cheap blocks claim more of them, and responsibilities records
+      whichever node computed each block. **/
+  void generateDynamically (function<T(int)> generator, int n) {
+    this->size = n;
+    int totalBlocks = max(1, min(n, Cluster::procs * Cluster::blocksPerProc * DYNAMIC_BLOCK_SCALE));
+    int blockSize = n / totalBlocks;
+    int numLeftOverElements = n % totalBlocks;
+    this->numResponsibilities = totalBlocks;
+    this->responsibilities = Pool::newArray<Responsibility>(totalBlocks);
+    int curStartIndex = 0;
     for (int block = 0; block < totalBlocks; block++) {
-      int startIndex = this->responsibilities[block].startIndex;
-      int numElements = this->responsibilities[block].numElements;
-      if (startIndex <= index && index < startIndex + numElements) {
-        nodeWithIndex = this->responsibilities[block].procId;
+      this->responsibilities[block].startIndex = curStartIndex;
+      this->responsibilities[block].numElements = (block < numLeftOverElements ?
+        blockSize + 1 : blockSize);
+      curStartIndex += this->responsibilities[block].numElements;
+    }
+
+    // Node 0 holds the index of the next block that hasn't been claimed
+    int *nextBlock;
+    MPI_Win counterWin;
+    MPI_Win_allocate(Cluster::procId == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL,
+      MPI_COMM_WORLD, &nextBlock, &counterWin);
+    if (Cluster::procId == 0) {
+      MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, counterWin);
+      *nextBlock = 0;
+      MPI_Win_unlock(0, counterWin);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Claim and compute blocks until there are none left
+    vector<int> myBlocks;
+    vector<SeqPart<T> > parts;
+    int one = 1;
+    int block;
+    MPI_Win_lock_all(0, counterWin);
+    while (true) {
+      MPI_Fetch_and_op(&one, &block, MPI_INT, 0, 0, MPI_SUM, counterWin);
+      MPI_Win_flush(0, counterWin);
+      if (block >= totalBlocks) {
+        break;
+      }
+      SeqPart<T> part;
+      part.startIndex = this->responsibilities[block].startIndex;
+      part.numElements = this->responsibilities[block].numElements;
+      part.data = allocatePartData(part.numElements);
+      Scheduler::parallelFor(part.numElements, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          new (&part.data[i]) T(generator(part.startIndex + i));
+        }
+      });
+      myBlocks.push_back(block);
+      parts.push_back(part);
+    }
+    MPI_Win_unlock_all(counterWin);
+    MPI_Win_free(&counterWin);
+
+    updateOwners(myBlocks);
+    setMySeqParts(parts);
+  }
+
+  /** Gives this sequence the same size and layout as 'other' (without copying any data) **/
+  template<typename S>
+  void initializeLike (UberSequence<S> *other) {
+    this->size = other->size;
+    this->numResponsibilities = other->numResponsibilities;
+    this->responsibilities = Pool::newArray<Responsibility>(this->numResponsibilities);
+    copy(other->responsibilities, other->responsibilities + this->numResponsibilities,
+      this->responsibilities);
+    allocateSeqParts();
+  }
+
+  /** True if both sequences split their elements into the same blocks on the same nodes **/
+  template<typename S>
+  bool hasSameLayout (UberSequence<S> *other) {
+    if (this->size != other->size || this->numResponsibilities != other->numResponsibilities) {
+      return false;
+    }
+    for (int i = 0; i < this->numResponsibilities; i++) {
+      if (this->responsibilities[i].procId != other->responsibilities[i].procId ||
+          this->responsibilities[i].startIndex != other->responsibilities[i].startIndex ||
+          this->responsibilities[i].numElements != other->responsibilities[i].numElements) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void destroy () {
+    assert(this->numViews == 0);
+    clearPartScratch();
+    if (this->viewed != NULL) {
+      releaseViewed();
+    } else {
+      for (int i = 0; i < this->numParts; i++) {
+        freePartData(this->mySeqParts[i].data, this->mySeqParts[i].numElements);
       }
     }
-    return nodeWithIndex;
+    Pool::deleteArray(this->mySeqParts, this->numParts);
+    Pool::deleteArray(this->responsibilities, this->numResponsibilities);
+  }
+
+  /** Stops this view (see slice) from referring to the viewed sequence's data **/
+  void releaseViewed () {
+    this->viewed->numViews--;
+    this->viewed = NULL;
+  }
+
+  /** Find which block (entry in responsibilities) has the element indexed by 'index'.
+      Responsibilities are in order of startIndex, so this is a binary search. **/
+  int getBlockWithData (int index) {
+    assert(0 <= index && index < this->size);
+    return upper_bound(this->responsibilities,
+      this->responsibilities + this->numResponsibilities, index,
+      [](int index, const Responsibility &block) { return index < block.startIndex; }) -
+      this->responsibilities - 1;
+  }
+
+  /** Find which node has the element indexed by 'index' **/
+  int getNodeWithData (int index) {
+    return this->responsibilities[getBlockWithData(index)].procId;
   }
 
   /** Assumes the current node has the element index by 'index'
       Otherwise, kills itself to prevent programming screwups **/
   T getData (int index) {
-    for (int part = 0; part < this->numParts; part++) {
-      int startIndex = this->mySeqParts[part].startIndex;
-      int numElements = this->mySeqParts[part].numElements;
-      if (startIndex <= index && index < startIndex + numElements) {
-        return this->mySeqParts[part].data[index - startIndex];
+    SeqPart<T> *part = upper_bound(this->mySeqParts, this->mySeqParts + this->numParts, index,
+      [](int index, const SeqPart<T> &part) { return index < part.startIndex; }) - 1;
+    assert(part >= this->mySeqParts && index < part->startIndex + part->numElements);
+    return part->data[index - part->startIndex];
+  }
+
+  /** Copies 'count' of my elements, from the 'first'th of them in order of index, to 'buffer'
+      (if toBuffer) or from it **/
+  void copyMyElements (int first, int count, T *buffer, bool toBuffer) {
+    int *partOffsets = getPartOffsets();
+    int part = upper_bound(partOffsets, partOffsets + this->numParts + 1, first) -
+      partOffsets - 1;
+    while (count > 0) {
+      int offset = first - partOffsets[part];
+      int n = min(count, this->mySeqParts[part].numElements - offset);
+      T *data = this->mySeqParts[part].data + offset;
+      if (toBuffer) {
+        copy(data, data + n, buffer);
+      } else {
+        copy(buffer, buffer + n, data);
       }
+      buffer += n;
+      first += n;
+      count -= n;
+      part++;
     }
-    assert(false);
-    T x;
-    return x;
   }
 
-  /** Call this at the end of every method **/
-  void endMethod () {
-    MPI_Barrier(MPI_COMM_WORLD);
+  /** Calls f(procId, startIndex, numElements) for each block's overlap with elements
+      [chunkStart, chunkEnd), in order of index **/
+  template<typename F>
+  void forEachChunkBlock (int chunkStart, int chunkEnd, F f) {
+    for (int block = getBlockWithData(chunkStart); block < this->numResponsibilities &&
+         this->responsibilities[block].startIndex < chunkEnd; block++) {
+      Responsibility &responsibility = this->responsibilities[block];
+      int startIndex = max(responsibility.startIndex, chunkStart);
+      int endIndex = min(responsibility.startIndex + responsibility.numElements, chunkEnd);
+      f(responsibility.procId, startIndex, endIndex - startIndex);
+    }
+  }
+
+  /** The counts and displacements (both in BYTES) of each node's elements amongst elements
+      [chunkStart, chunkEnd), packed by node, then in order of index **/
+  void getChunkCounts (int chunkStart, int chunkEnd, int *counts, int *displs) {
+    fill(counts, counts + Cluster::procs, 0);
+    forEachChunkBlock(chunkStart, chunkEnd, [counts](int procId, int startIndex, int n) {
+      counts[procId] += n * sizeof(T);
+    });
+    displs[0] = 0;
+    for (int procId = 1; procId < Cluster::procs; procId++) {
+      displs[procId] = displs[procId - 1] + counts[procId - 1];
+    }
   }
 
-  /** Gets reduces for each thread block in the sequence part
-      E.g. if the sequence part is (1, 3, 5, 2, 8, 1) and there are 2 thread blocks
-           then the sequence reduces are 9 and 11 for each block.
-      Warning: seqPartialReduces is indexed abnormally to avoid false sharing **/
-  T *getSeqPartialReduces (SeqPart<T> *seqPart, function<T(T,T)> combiner) {
-    int indexScaling = 64 / sizeof(T); // Scale all indices to prevent false sharing
-    T *seqPartialReduces = new T[this->numThreadBlocks * indexScaling];
-    #pragma omp parallel
-    {
-      // Find out which part of the seqPart I'm responsible for
-      int numThreads = omp_get_num_threads();
-      int threadId = omp_get_thread_num();
-      int numElements = seqPart->numElements;
-      int equalSplit = numElements / numThreads;
-      int numLeftOverElements = numElements % numThreads;
-      int myLeftOver = threadId < numLeftOverElements;
-      int startIndex;
-      if (myLeftOver) {
-        startIndex = threadId * (equalSplit + 1);
+  /** Copies elements [chunkStart, chunkEnd) of 'array' to 'packed' (if toPacked) or back,
+      where 'packed' holds them by node as in getChunkCounts **/
+  void packChunk (int chunkStart, int chunkEnd, T *array, T *packed, int *displs,
+                  bool toPacked) {
+    vector<int> next(displs, displs + Cluster::procs);
+    forEachChunkBlock(chunkStart, chunkEnd, [&](int procId, int startIndex, int n) {
+      T *packedData = packed + next[procId] / sizeof(T);
+      if (toPacked) {
+        copy(array + startIndex, array + startIndex + n, packedData);
       } else {
-        startIndex = threadId * equalSplit + numLeftOverElements;
+        copy(packedData, packedData + n, array + startIndex);
       }
-      if (startIndex < seqPart->numElements) {
-        int myNumElements = equalSplit + myLeftOver;
+      next[procId] += n * sizeof(T);
+    });
+  }
 
-        // Compute my partial reduce
-        int threadIdx = threadId * indexScaling;
-        seqPartialReduces[threadIdx] = seqPart->data[startIndex];
-        for (int i = 1; i < myNumElements; i++) {
-          seqPartialReduces[threadIdx] = combiner(seqPartialReduces[threadIdx], 
-            seqPart->data[startIndex + i]);
-        }
+  /** Returns the number of elements before each of my sequence parts, followed by the total
+      number of elements I hold (numParts + 1 entries). Owned by the sequence. **/
+  int *getPartOffsets () {
+    if (this->partOffsets == NULL) {
+      this->partOffsets = Pool::newArray<int>(this->numParts + 1);
+      this->partOffsets[0] = 0;
+      for (int part = 0; part < this->numParts; part++) {
+        this->partOffsets[part + 1] = this->partOffsets[part] + this->mySeqParts[part].numElements;
       }
     }
-    return seqPartialReduces;
-  }
-
-  /** Makes the partial reduces into partial scans
-      E.g. (0, 1, 3, 6) becomes (0, 1, 4, 10)
-      Warning: seqPartialReduces is indexed abnormally to avoid false sharing **/
-  void makeSeqPartialScans (T *seqPartialReduces, function<T(T,T)> combiner) {
-    int indexScaling = 64 / sizeof(T); // Scale all indices to prevent false sharing
-    for (int i = 1; i < this->numThreadBlocks; i++) {
-      seqPartialReduces[i * indexScaling] = combiner(seqPartialReduces[(i - 1) * indexScaling], 
-        seqPartialReduces[i * indexScaling]);
-    }
-  }
-
-  /** Let's say seqPart is (1, 4, 2, 8, 9, 11), there are 3 thread blocks, and combiner is +
-      init is the scan to the start of the sequence part (let's say it's 5)
-      seqPartialScans is (5, 10, 20)
-      Then seqPart will be transformed to (5+1, 5+1+4, 5+1+4+2, 5+1+4+2+8, ...)
-      In effect 'applying' the scan to the sequence part **/
-  void applySeqScans (SeqPart<T> *seqPart, function<T(T,T)> combiner, T init, T *seqPartialScans) {
-    int indexScaling = 64 / sizeof(T); // Scale all indices to prevent false sharing
-    #pragma omp parallel
-    {
-      // Find out which part of the seqPart I'm responsible for
-      int numThreads = omp_get_num_threads();
-      int threadId = omp_get_thread_num();
-      int numElements = seqPart->numElements;
-      int equalSplit = numElements / numThreads;
-      int numLeftOverElements = numElements % numThreads;
-      int myLeftOver = threadId < numLeftOverElements;
-      int startIndex;
-      if (myLeftOver) {
-        startIndex = threadId * (equalSplit + 1);
-      } else {
-        startIndex = threadId * equalSplit + numLeftOverElements;
-      }
-      int myNumElements = equalSplit + myLeftOver;
+    return this->partOffsets;
+  }
 
-      if (startIndex < seqPart->numElements) {
-        // Compute my scans
-        int threadIdx = threadId * indexScaling;
-        T scan;
-        if (threadId == 0) {
-          scan = init;
+  /** Returns the tiles reduces and scans split my sequence parts into. Owned by the sequence. **/
+  vector<Kernels::Tile> &getTiles () {
+    if (this->tiles.empty()) {
+      this->tiles = Kernels::getTiles(this->numParts, getPartOffsets());
+    }
+    return this->tiles;
+  }
+
+  /** Returns the (smaller) tiles of single pass scans (see Kernels::chainedScan) **/
+  vector<Kernels::Tile> &getChainedTiles () {
+    if (this->chainedTiles.empty()) {
+      this->chainedTiles = Kernels::getChainedTiles(this->numParts, getPartOffsets(), sizeof(T));
+    }
+    return this->chainedTiles;
+  }
+
+  /** Returns RMA windows exposing my sequence parts, one per part index, since nodes can
+      hold different numbers of parts. Part 'part' of node 'procId' is at displacement 0
+      (in bytes) of partWindows[part] on procId. Collective the first time it is called
+      after the parts change. **/
+  vector<MPI_Win> &getPartWindows () {
+    if (this->partWindows.empty()) {
+      int maxParts = this->numParts;
+      MPI_Allreduce(MPI_IN_PLACE, &maxParts, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+      this->partWindows.resize(maxParts);
+      for (int part = 0; part < maxParts; part++) {
+        if (part < this->numParts) {
+          MPI_Win_create(this->mySeqParts[part].data, this->mySeqParts[part].numElements *
+            sizeof(T), 1, MPI_INFO_NULL, MPI_COMM_WORLD, &this->partWindows[part]);
         } else {
-          scan = combiner(init, seqPartialScans[threadIdx - indexScaling]);
-        }
-        for (int i = 0; i < myNumElements; i++) {
-          scan = combiner(scan, seqPart->data[startIndex + i]);
-          seqPart->data[startIndex + i] = scan;
+          MPI_Win_create(NULL, 0, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &this->partWindows[part]);
         }
       }
     }
+    return this->partWindows;
+  }
+
+  /** Must be called before mySeqParts is replaced, as the scratch depends on its layout.
+      Collective if the part windows have been created. **/
+  void clearPartScratch () {
+    if (this->partOffsets != NULL) {
+      Pool::deleteArray(this->partOffsets, this->numParts + 1);
+      this->partOffsets = NULL;
+    }
+    this->tiles.clear();
+    this->chainedTiles.clear();
+    for (size_t part = 0; part < this->partWindows.size(); part++) {
+      MPI_Win_free(&this->partWindows[part]);
+    }
+    this->partWindows.clear();
+  }
+
+  /** Calls body(part, i) for every element of every one of my sequence parts, using all
+      threads over all parts at once (rather than one parallel loop per part) **/
+  template<typename Body>
+  void forEachElement (Body body) {
+    double startTime = CycleTimer::currentSeconds();
+    int *partOffsets = getPartOffsets();
+    Kernels::forEachElement(this->numParts, partOffsets, body);
+    recordWork(partOffsets[this->numParts], CycleTimer::currentSeconds() - startTime);
+  }
+
+  /** Sets every element of my sequence parts to generator(its index) **/
+  void generate (function<T(int)> generator) {
+    SeqPart<T> *parts = this->mySeqParts;
+    fillWith([parts, &generator](int part, int i) {
+      return generator(parts[part].startIndex + i);
+    });
+  }
+
+  /** Sets element i of each of my sequence parts to loader(part, i) **/
+  template<typename Loader>
+  void fillWith (Loader loader) {
+    SeqPart<T> *parts = this->mySeqParts;
+    forEachElement([parts, &loader](int part, int i) {
+      parts[part].data[i] = loader(part, i);
+    });
+  }
+
+  /** Reduces the elements loader(part, i) of each of my sequence parts, then combines the
+      results from accross the cluster. reduce() loads straight from mySeqParts, while
+      DelayedSequence passes a fused loader so no intermediate sequence is built. **/
+  template<typename R, typename Loader, typename Combiner>
+  R reduceWith (Loader loader, Combiner combiner, R init) {
+    double startTime = CycleTimer::currentSeconds();
+    int *partOffsets = getPartOffsets();
+    vector<Kernels::Tile> &tiles = getTiles();
+    R *tileReduces = Pool::newArray<R>(tiles.size());
+    Kernels::getTileReduces(tiles, loader, combiner, tileReduces);
+    recordWork(partOffsets[this->numParts], CycleTimer::currentSeconds() - startTime);
+    R value = combineTileReduces(tiles, tileReduces, combiner, init);
+    Pool::deleteArray(tileReduces, tiles.size());
+    return value;
+  }
+
+  /** Given the reduces of tiles of my sequence parts, in order, returns init combined
+      with the reduce of the whole sequence **/
+  template<typename R, typename Combiner>
+  R combineTileReduces (vector<Kernels::Tile> &tiles, R *tileReduces, Combiner combiner,
+                        R init) {
+    R value = init;
+    if (CombinerTraits<Combiner>::commutative || isRankContiguous()) {
+      // Nodes can combine all their blocks, and MPI combines the nodes' results
+      NodeReduce<R> myReduce = getNodeReduce(tiles.size(), tileReduces, combiner);
+      NodeReduce<R> reduce = allreduceNodeReduce(myReduce, combiner, UseMpiOp<R, Combiner>());
+      if (reduce.present) {
+        value = combiner(value, reduce.value);
+      }
+      return value;
+    }
+
+    // Each node combines a contiguous range of the blocks (see getRangeReduces). The
+    // ranges are in rank order, so MPI combines them in order.
+    R *myPartialReduces = Pool::newArray<R>(this->numParts);
+    Kernels::getPartReduces(tiles, tileReduces, combiner, myPartialReduces);
+    int *sendcounts = Pool::newArray<int>(Cluster::procs);
+    int *recvcounts = Pool::newArray<int>(Cluster::procs);
+    R *rangeReduces = getRangeReduces(myPartialReduces, sendcounts, recvcounts);
+    int rangeSize = getRangeStart(Cluster::procId + 1) - getRangeStart(Cluster::procId);
+    NodeReduce<R> myReduce = getNodeReduce(rangeSize, rangeReduces, combiner);
+    NodeReduce<R> reduce = allreduceNodeReduce(myReduce, combiner, false_type());
+    if (reduce.present) {
+      value = combiner(value, reduce.value);
+    }
+
+    Pool::deleteArray(myPartialReduces, this->numParts);
+    Pool::deleteArray(sendcounts, Cluster::procs);
+    Pool::deleteArray(recvcounts, Cluster::procs);
+    Pool::deleteArray(rangeReduces, rangeSize);
+    return value;
+  }
+
+  /** Scans the elements loader(part, i) over the whole sequence, and passes each result to
+      storer(part, i, value). Like reduceWith, this lets scans consume fused pipelines. **/
+  template<typename R, typename Loader, typename Storer, typename Combiner>
+  void scanWith (Loader loader, Storer storer, Combiner combiner, R init) {
+    Kernels::NoTileHook hook;
+    scanWith(loader, storer, combiner, init, hook);
+  }
+
+  /** Same, but calls hook.start(tiles) with the tiles the scan will use, and hook(t, tile)
+      after each tile is scanned (see Kernels::TileReducer) **/
+  template<typename R, typename Loader, typename Storer, typename Combiner, typename Hook>
+  void scanWith (Loader loader, Storer storer, Combiner combiner, R init, Hook &hook) {
+    double startTime = CycleTimer::currentSeconds();
+    int *partOffsets = getPartOffsets();
+    if (isOnOneNode()) {
+      // Nothing has to arrive from other nodes first, so the scan takes a single pass
+      vector<Kernels::Tile> &tiles = getChainedTiles();
+      hook.start(tiles);
+      Kernels::chainedScan(tiles, loader, storer, combiner, init, hook);
+      recordWork(partOffsets[this->numParts], CycleTimer::currentSeconds() - startTime);
+      return;
+    }
+    vector<Kernels::Tile> &tiles = getTiles();
+    hook.start(tiles);
+    R *tileReduces = Pool::newArray<R>(tiles.size());
+    Kernels::getTileReduces(tiles, loader, combiner, tileReduces);
+    R *myPartialReduces = Pool::newArray<R>(this->numParts);
+    Kernels::getPartReduces(tiles, tileReduces, combiner, myPartialReduces);
+    double localTime = CycleTimer::currentSeconds() - startTime;
+
+    // Get the combination of all values before each of my parts
+    R *partInits = Pool::newArray<R>(this->numParts);
+    if (isRankContiguous()) {
+      // Everything before my first part is on lower ranked nodes
+      NodeReduce<R> myReduce = getNodeReduce(tiles.size(), tileReduces, combiner);
+      NodeReduce<R> before = exscanNodeReduce(myReduce, combiner);
+      startTime = CycleTimer::currentSeconds();
+      R scan = before.present ? combiner(init, before.value) : init;
+      for (int part = 0; part < this->numParts; part++) {
+        partInits[part] = scan;
+        scan = combiner(scan, myPartialReduces[part]);
+      }
+    } else {
+      // Each node scans a contiguous range of the blocks (see getRangeReduces), starting
+      // from everything before its range, and sends each block's init back to its owner
+      int *sendcounts = Pool::newArray<int>(Cluster::procs);
+      int *recvcounts = Pool::newArray<int>(Cluster::procs);
+      R *rangeReduces = getRangeReduces(myPartialReduces, sendcounts, recvcounts);
+      int rangeStart = getRangeStart(Cluster::procId);
+      int rangeSize = getRangeStart(Cluster::procId + 1) - rangeStart;
+      NodeReduce<R> myReduce = getNodeReduce(rangeSize, rangeReduces, combiner);
+      NodeReduce<R> before = exscanNodeReduce(myReduce, combiner);
+      startTime = CycleTimer::currentSeconds();
+      R scan = before.present ? combiner(init, before.value) : init;
+      int *next = Pool::newArray<int>(Cluster::procs);
+      Exchange::getDispls(recvcounts, next);
+      R *rangeInits = Pool::newArray<R>(rangeSize);
+      for (int block = rangeStart; block < rangeStart + rangeSize; block++) {
+        rangeInits[next[this->responsibilities[block].procId]++] = scan;
+        scan = combiner(scan, rangeReduces[block - rangeStart]);
+      }
+
+      // My blocks' inits come back in order of range, so in order of block
+      Exchange::alltoallv(rangeInits, recvcounts, sendcounts, partInits);
+      Pool::deleteArray(sendcounts, Cluster::procs);
+      Pool::deleteArray(recvcounts, Cluster::procs);
+      Pool::deleteArray(rangeReduces, rangeSize);
+      Pool::deleteArray(next, Cluster::procs);
+      Pool::deleteArray(rangeInits, rangeSize);
+    }
+    Kernels::makeTileInits(tiles, tileReduces, combiner, partInits);
+    Kernels::applyTileScans(tiles, loader, storer, combiner, tileReduces, hook);
+    recordWork(partOffsets[this->numParts], localTime + CycleTimer::currentSeconds() - startTime);
+
+    Pool::deleteArray(tileReduces, tiles.size());
+    Pool::deleteArray(myPartialReduces, this->numParts);
+    Pool::deleteArray(partInits, this->numParts);
+  }
+
+  /** The first block of the range of blocks node procId combines for reduces and scans
+      whose layout isn't rank contiguous. Node p's range is blocks [getRangeStart(p),
+      getRangeStart(p + 1)), so the ranges are contiguous and in rank order. **/
+  int getRangeStart (int procId) {
+    return (long long)procId * this->numResponsibilities / Cluster::procs;
+  }
+
+  /** Given the reduced values of my sequence parts, in order, sends each to the node whose
+      range (see getRangeStart) has its block, with one MPI_Alltoallv, and returns the
+      reduced values of the blocks in my range, in order. Sets sendcounts[p] and
+      recvcounts[p] to how many went to and came from node p. Each node handles about
+      blocksPerProc values, rather than every node combining every block's value as
+      with getPartialReduces, and MPI then combines the ranges' values in log(procs) steps. **/
+  template<typename R>
+  R *getRangeReduces (R *myPartialReduces, int *sendcounts, int *recvcounts) {
+    int procs = Cluster::procs;
+    int rangeStart = getRangeStart(Cluster::procId);
+    int rangeSize = getRangeStart(Cluster::procId + 1) - rangeStart;
+    fill(sendcounts, sendcounts + procs, 0);
+    fill(recvcounts, recvcounts + procs, 0);
+    for (int block = 0, rangeNode = 0; block < this->numResponsibilities; block++) {
+      while (block >= getRangeStart(rangeNode + 1)) {
+        rangeNode++;
+      }
+      int owner = this->responsibilities[block].procId;
+      if (owner == Cluster::procId) {
+        sendcounts[rangeNode]++;
+      }
+      if (rangeNode == Cluster::procId) {
+        recvcounts[owner]++;
+      }
+    }
+    R *received = Exchange::alltoallv(myPartialReduces, sendcounts, recvcounts);
+
+    // They arrive grouped by owner, so put them back in order of block
+    int *next = Pool::newArray<int>(procs);
+    int numReceived = Exchange::getDispls(recvcounts, next);
+    R *rangeReduces = Pool::newArray<R>(rangeSize);
+    for (int block = rangeStart; block < rangeStart + rangeSize; block++) {
+      rangeReduces[block - rangeStart] = received[next[this->responsibilities[block].procId]++];
+    }
+
+    Pool::deleteArray(received, numReceived);
+    Pool::deleteArray(next, procs);
+    return rangeReduces;
   }
 
-  /** Returns combiner(seqPartialReduces[0], combiner(seqPartialReduces[0], ...)) **/
-  T getSeqReduce (SeqPart<T> *seqPart, T *seqPartialReduces, function<T(T,T)> combiner) {
-    int indexScaling = 64 / sizeof(T); // Scale all indices to prevent false sharing
-    T reduce = seqPartialReduces[0];
-    for (int i = 1; i < min(this->numThreadBlocks, seqPart->numElements); i++) {
-      reduce = combiner(reduce, seqPartialReduces[i * indexScaling]);
+  /** True if every block is on the same node (e.g. there is only one node) **/
+  bool isOnOneNode () {
+    for (int i = 1; i < this->numResponsibilities; i++) {
+      if (this->responsibilities[i].procId != this->responsibilities[0].procId) {
+        return false;
+      }
     }
+    return true;
+  }
+
+  /** True if each node's blocks are consecutive, and in order of procId. Then combining
+      the nodes' results in rank order (as MPI does) keeps the order of the elements. **/
+  bool isRankContiguous () {
+    for (int i = 1; i < this->numResponsibilities; i++) {
+      if (this->responsibilities[i].procId < this->responsibilities[i - 1].procId) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** Combines every node's NodeReduce, in rank order, with the combiner as an MPI_Op **/
+  template<typename R, typename Combiner>
+  static NodeReduce<R> allreduceNodeReduce (NodeReduce<R> myReduce, Combiner &combiner,
+                                            false_type) {
+    NodeReduce<R> reduce;
+    CombinerOp<R, Combiner>::combiner = &combiner;
+    MPI_Allreduce(&myReduce, &reduce, 1, CombinerOp<R, Combiner>::getDatatype(),
+      CombinerOp<R, Combiner>::getOp(), MPI_COMM_WORLD);
     return reduce;
   }
 
+  /** Same, for built in combiners: nodes without blocks contribute the identity **/
+  template<typename R, typename Combiner>
+  static NodeReduce<R> allreduceNodeReduce (NodeReduce<R> myReduce, Combiner &combiner,
+                                            true_type) {
+    NodeReduce<R> reduce;
+    reduce.value = myReduce.present ? myReduce.value : Combiner::template identity<R>();
+    reduce.present = true;
+    MPI_Allreduce(MPI_IN_PLACE, &reduce.value, 1, MpiType<R>::get(), MpiOp<Combiner>::get(),
+      MPI_COMM_WORLD);
+    return reduce;
+  }
+
+  /** Returns the combination of the NodeReduces of all the lower ranked nodes, in rank
+      order, with the combiner as an MPI_Op. Not present on node 0, or if none of them
+      hold any blocks. **/
+  template<typename R, typename Combiner>
+  static NodeReduce<R> exscanNodeReduce (NodeReduce<R> myReduce, Combiner &combiner) {
+    NodeReduce<R> before;
+    CombinerOp<R, Combiner>::combiner = &combiner;
+    MPI_Exscan(&myReduce, &before, 1, CombinerOp<R, Combiner>::getDatatype(),
+      CombinerOp<R, Combiner>::getOp(), MPI_COMM_WORLD);
+    if (Cluster::procId == 0) {
+      before.present = false; // MPI_Exscan leaves node 0's result undefined
+    }
+    return before;
+  }
+
+  /** Combines the reduces of all my tiles, in order **/
+  template<typename R, typename Combiner>
+  static NodeReduce<R> getNodeReduce (int numTiles, R *tileReduces, Combiner combiner) {
+    NodeReduce<R> nodeReduce;
+    nodeReduce.present = numTiles > 0;
+    if (numTiles > 0) {
+      nodeReduce.value = tileReduces[0];
+      for (int t = 1; t < numTiles; t++) {
+        nodeReduce.value = combiner(nodeReduce.value, tileReduces[t]);
+      }
+    }
+    return nodeReduce;
+  }
+
   /** Given reduced values for each sequence part in the current node, in order
       Returns an ordered list of reduced values for each entry in responsibilities
         (from accross the cluster) **/
-  T *getPartialReduces (T *myPartialReduces) {
+  template<typename R>
+  R *getPartialReduces (R *myPartialReduces) {
+    MPI_Request request;
+    PartialReduceExchange<R> exchange = startPartialReduces(myPartialReduces, &request);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    return finishPartialReduces(exchange);
+  }
+
+  /** Starts gathering the reduced values of every node's sequence parts on every node.
+      myPartialReduces must be kept until the request completes. **/
+  template<typename R>
+  PartialReduceExchange<R> startPartialReduces (R *myPartialReduces, MPI_Request *request) {
     // Compute receive counts, displacements for AllGatherV
-    int totalBlocks = Cluster::blocksPerProc * Cluster::procs;
-    T *recvbuf = new T[totalBlocks];
-    int *recvcounts = new int[Cluster::procs]; // Note, this is in BYTES
-    int *displs = new int[Cluster::procs]; // Note, this is in BYTES
-    for (int i = 0; i < Cluster::procs; i++) {
-      recvcounts[i] = Cluster::blocksPerProc * sizeof(T);
-      displs[i] = i * Cluster::blocksPerProc * sizeof(T);
-    }
-
-    // MPI all gatherv
-    MPI_Barrier(MPI_COMM_WORLD); // Is the barrier necessary?
-    MPI_Allgatherv(myPartialReduces, this->numParts * sizeof(T), MPI_BYTE, 
-      recvbuf, recvcounts, displs, MPI_BYTE, MPI_COMM_WORLD);
-
-    // Sort the receive buffer into the correct order to get partialReduces
-    T *partialReduces = new T[totalBlocks];
-    int reduceCounts[Cluster::procs];
-    fill(reduceCounts, reduceCounts + Cluster::procs, 0);
-    for (int i = 0; i < totalBlocks; i++) {
-      int procId = responsibilities[i].procId;
-      int recvIndex = Cluster::blocksPerProc * procId + reduceCounts[procId];
+    PartialReduceExchange<R> exchange;
+    exchange.totalBlocks = this->numResponsibilities;
+    exchange.owners = Pool::newArray<int>(exchange.totalBlocks);
+    exchange.recvbuf = Pool::newArray<R>(exchange.totalBlocks);
+    exchange.recvcounts = Pool::newArray<int>(Cluster::procs);
+    exchange.displs = Pool::newArray<int>(Cluster::procs);
+    for (int i = 0; i < exchange.totalBlocks; i++) {
+      exchange.owners[i] = this->responsibilities[i].procId;
+      exchange.recvcounts[exchange.owners[i]] += sizeof(R);
+    }
+    exchange.displs[0] = 0;
+    for (int i = 1; i < Cluster::procs; i++) {
+      exchange.displs[i] = exchange.displs[i - 1] + exchange.recvcounts[i - 1];
+    }
+
+    MPI_Iallgatherv(myPartialReduces, this->numParts * sizeof(R), MPI_BYTE, exchange.recvbuf,
+      exchange.recvcounts, exchange.displs, MPI_BYTE, MPI_COMM_WORLD, request);
+    return exchange;
+  }
+
+  /** Once the exchange's request completes, sorts the receive buffer into the order of
+      responsibilities, and frees the exchange **/
+  template<typename R>
+  static R *finishPartialReduces (PartialReduceExchange<R> &exchange) {
+    R *partialReduces = Pool::newArray<R>(exchange.totalBlocks);
+    int *reduceCounts = Pool::newArray<int>(Cluster::procs);
+    for (int i = 0; i < exchange.totalBlocks; i++) {
+      int procId = exchange.owners[i];
+      int recvIndex = exchange.displs[procId] / sizeof(R) + reduceCounts[procId];
       reduceCounts[procId]++;
-      partialReduces[i] = recvbuf[recvIndex];
+      partialReduces[i] = exchange.recvbuf[recvIndex];
     }
 
     // Free everything & Return
-    delete[] recvbuf;
-    delete[] recvcounts;
-    delete[] displs;
+    Pool::deleteArray(reduceCounts, Cluster::procs);
+    Pool::deleteArray(exchange.owners, exchange.totalBlocks);
+    Pool::deleteArray(exchange.recvbuf, exchange.totalBlocks);
+    Pool::deleteArray(exchange.recvcounts, Cluster::procs);
+    Pool::deleteArray(exchange.displs, Cluster::procs);
     return partialReduces;
   }
 
-  /** Returns an ordered list of reduced values for each entry in responsibilities
-        (from accross the cluster) **/
-  T *getPartialReduces (function<T(T,T)> combiner) {
-    // Get all my partial results (sendbuf). Note assumes each part has >= 1 element.
-    T *myPartialReduces = new T[this->numParts];
-    for (int part = 0; part < this->numParts; part++) {
-      int numElements = this->mySeqParts[part].numElements;
-      T *curData = this->mySeqParts[part].data;
-      myPartialReduces[part] = curData[0];
-      for (int i = 1; i < numElements; i++) {
-        myPartialReduces[part] = combiner(myPartialReduces[part], curData[i]);
+  /** Like reduceWith, but returns once the local work is done and the nodes' results are on
+      their way. The nodes' results are gathered rather than combined by MPI, so that
+      several asynchronous reduces with the same combiner can be in flight at once. **/
+  template<typename R, typename Loader, typename Combiner>
+  Future<R> reduceWithAsync (Loader loader, Combiner combiner, R init) {
+    double startTime = CycleTimer::currentSeconds();
+    int *partOffsets = getPartOffsets();
+    vector<Kernels::Tile> &tiles = getTiles();
+    R *tileReduces = Pool::newArray<R>(tiles.size());
+    Kernels::getTileReduces(tiles, loader, combiner, tileReduces);
+    MPI_Request request;
+
+    if (CombinerTraits<Combiner>::commutative || isRankContiguous()) {
+      // Gather one combined value per node, which every node combines in rank order
+      int procs = Cluster::procs;
+      NodeReduce<R> *nodeReduces = Pool::newArray<NodeReduce<R> >(procs + 1);
+      nodeReduces[procs] = getNodeReduce(tiles.size(), tileReduces, combiner);
+      Pool::deleteArray(tileReduces, tiles.size());
+      recordWork(partOffsets[this->numParts], CycleTimer::currentSeconds() - startTime);
+      MPI_Iallgather(&nodeReduces[procs], sizeof(NodeReduce<R>), MPI_BYTE, nodeReduces,
+        sizeof(NodeReduce<R>), MPI_BYTE, MPI_COMM_WORLD, &request);
+      return Future<R>(request, [nodeReduces, procs, combiner, init]() {
+        R value = init;
+        for (int procId = 0; procId < procs; procId++) {
+          if (nodeReduces[procId].present) {
+            value = combiner(value, nodeReduces[procId].value);
+          }
+        }
+        Pool::deleteArray(nodeReduces, procs + 1);
+        return value;
+      });
+    }
+
+    int numParts = this->numParts;
+    R *myPartialReduces = Pool::newArray<R>(numParts);
+    Kernels::getPartReduces(tiles, tileReduces, combiner, myPartialReduces);
+    Pool::deleteArray(tileReduces, tiles.size());
+    recordWork(partOffsets[this->numParts], CycleTimer::currentSeconds() - startTime);
+    PartialReduceExchange<R> exchange = startPartialReduces(myPartialReduces, &request);
+    return Future<R>(request, [exchange, myPartialReduces, numParts, combiner, init]() mutable {
+      R *partialReduces = finishPartialReduces(exchange);
+      R value = init;
+      for (int i = 0; i < exchange.totalBlocks; i++) {
+        value = combiner(value, partialReduces[i]);
       }
+      Pool::deleteArray(partialReduces, exchange.totalBlocks);
+      Pool::deleteArray(myPartialReduces, numParts);
+      return value;
+    });
+  }
+
+  /** Like scanWith, but returns once the tile reduces are done and the parts' reduces are on
+      their way. The scans are applied when the future is waited on, so the sequence
+      mustn't be used (or changed) until then. **/
+  template<typename R, typename Loader, typename Storer, typename Combiner>
+  Future<void> scanWithAsync (Loader loader, Storer storer, Combiner combiner, R init) {
+    double startTime = CycleTimer::currentSeconds();
+    int *partOffsets = getPartOffsets();
+    if (isOnOneNode()) {
+      Kernels::NoTileHook hook;
+      Kernels::chainedScan(getChainedTiles(), loader, storer, combiner, init, hook);
+      recordWork(partOffsets[this->numParts], CycleTimer::currentSeconds() - startTime);
+      return Future<void>(MPI_REQUEST_NULL, []() {});
     }
+    vector<Kernels::Tile> &tiles = getTiles();
+    int numTiles = tiles.size();
+    int numParts = this->numParts;
+    R *tileReduces = Pool::newArray<R>(numTiles);
+    Kernels::getTileReduces(tiles, loader, combiner, tileReduces);
+    R *myPartialReduces = Pool::newArray<R>(numParts);
+    Kernels::getPartReduces(tiles, tileReduces, combiner, myPartialReduces);
+    double localTime = CycleTimer::currentSeconds() - startTime;
+
+    MPI_Request request;
+    PartialReduceExchange<R> exchange = startPartialReduces(myPartialReduces, &request);
+    int myProcId = Cluster::procId;
+    return Future<void>(request, [=]() mutable {
+      double startTime = CycleTimer::currentSeconds();
+      R *partialReduces = finishPartialReduces(exchange);
+
+      // Get the combination of all values before each of my parts
+      R *partInits = Pool::newArray<R>(numParts);
+      R scan = init;
+      int myBlocksScanned = 0;
+      for (int i = 0; i < exchange.totalBlocks; i++) {
+        if (exchange.owners[i] == myProcId) {
+          partInits[myBlocksScanned] = scan;
+          myBlocksScanned++;
+        }
+        scan = combiner(scan, partialReduces[i]);
+      }
+      vector<Kernels::Tile> &tiles = getTiles();
+      Kernels::makeTileInits(tiles, tileReduces, combiner, partInits);
+      Kernels::applyTileScans(tiles, loader, storer, combiner, tileReduces);
+      recordWork(partOffsets[numParts], localTime + CycleTimer::currentSeconds() - startTime);
 
-    return getPartialReduces(myPartialReduces);
+      Pool::deleteArray(tileReduces, numTiles);
+      Pool::deleteArray(myPartialReduces, numParts);
+      Pool::deleteArray(partialReduces, exchange.totalBlocks);
+      Pool::deleteArray(partInits, numParts);
+    });
   }
 
   /** API Functions **/
@@ -354,28 +1350,86 @@ public:
 
   UberSequence (T *array, int n) {
     initialize(n);
-    for (int part = 0; part < this->numParts; part++) {
-      int startIndex = this->mySeqParts[part].startIndex;
-      int numElements = this->mySeqParts[part].numElements;
-      #pragma omp parallel for
-      for (int i = 0; i < numElements; i++) {
-        this->mySeqParts[part].data[i] = array[startIndex + i];
+    SeqPart<T> *parts = this->mySeqParts;
+    fillWith([parts, array](int part, int i) { return array[parts[part].startIndex + i]; });
+  }
+
+  /** A sequence of the n elements of 'array', which only node 'root' has to hold (the
+      other nodes may pass NULL). The elements go out with MPI_Iscatterv, in chunks of
+      about ROOT_CHUNK_BYTES of the array, and the next chunk is packed while the last one
+      is on its way, so nodes need at most two chunks on top of their share. **/
+  UberSequence (T *array, int n, int root) {
+    initialize(n);
+    int procs = Cluster::procs;
+    int chunkElements = max(1, ROOT_CHUNK_BYTES / (int)sizeof(T));
+    int numChunks = (n + chunkElements - 1) / chunkElements;
+    bool isRoot = Cluster::procId == root;
+    T *sendbufs[2];
+    T *recvbufs[2];
+    int *sendcounts[2]; // Note, this is in BYTES
+    int *displs[2]; // Note, this is in BYTES
+    MPI_Request requests[2];
+    for (int buffer = 0; buffer < 2; buffer++) {
+      sendbufs[buffer] = Pool::allocateArray<T>(isRoot ? chunkElements : 0);
+      recvbufs[buffer] = Pool::allocateArray<T>(chunkElements);
+      sendcounts[buffer] = Pool::newArray<int>(procs);
+      displs[buffer] = Pool::newArray<int>(procs);
+    }
+
+    // Chunk c is sent from buffer c % 2, and unpacked into my parts after chunk c + 1 is sent
+    int received = 0;
+    for (int chunk = 0; chunk <= numChunks; chunk++) {
+      int buffer = chunk % 2;
+      if (chunk < numChunks) {
+        int chunkStart = chunk * chunkElements;
+        int chunkEnd = min(n, chunkStart + chunkElements);
+        getChunkCounts(chunkStart, chunkEnd, sendcounts[buffer], displs[buffer]);
+        if (isRoot) {
+          packChunk(chunkStart, chunkEnd, array, sendbufs[buffer], displs[buffer], true);
+        }
+        MPI_Iscatterv(sendbufs[buffer], sendcounts[buffer], displs[buffer], MPI_BYTE,
+          recvbufs[buffer], sendcounts[buffer][Cluster::procId], MPI_BYTE, root,
+          MPI_COMM_WORLD, &requests[buffer]);
+      }
+      if (chunk > 0) {
+        int last = 1 - buffer;
+        MPI_Wait(&requests[last], MPI_STATUS_IGNORE);
+        int count = sendcounts[last][Cluster::procId] / sizeof(T);
+        copyMyElements(received, count, recvbufs[last], false);
+        received += count;
       }
     }
-    endMethod();
+
+    // Clean up
+    for (int buffer = 0; buffer < 2; buffer++) {
+      Pool::deleteArray(sendbufs[buffer], isRoot ? chunkElements : 0);
+      Pool::deleteArray(recvbufs[buffer], chunkElements);
+      Pool::deleteArray(sendcounts[buffer], procs);
+      Pool::deleteArray(displs[buffer], procs);
+    }
   }
 
   UberSequence (function<T(int)> generator, int n) {
     initialize(n);
-    for (int part = 0; part < this->numParts; part++) {
-      int startIndex = this->mySeqParts[part].startIndex;
-      int numElements = this->mySeqParts[part].numElements;
-      #pragma omp parallel for
-      for (int i = 0; i < numElements; i++) {
-        this->mySeqParts[part].data[i] = generator(startIndex + i);
-      }
+    generate(generator);
+  }
+
+  /** With DYNAMIC_BALANCING, use for generators whose cost varies a lot between elements **/
+  UberSequence (function<T(int)> generator, int n, Balancing balancing) {
+    if (balancing == DYNAMIC_BALANCING) {
+      generateDynamically(generator, n);
+    } else {
+      initialize(n);
+      generate(generator);
     }
-    endMethod();
+  }
+
+  /** A sequence of layout->length() elements, split into the same blocks on the same nodes
+      as 'layout', so the two can be zipped (see zipWith) without moving any data **/
+  template<typename S>
+  UberSequence (function<T(int)> generator, UberSequence<S> *layout) {
+    initializeLike(layout);
+    generate(generator);
   }
 
   ~UberSequence() {
@@ -385,92 +1439,668 @@ public:
   template<typename S>
   UberSequence<S> *map(function<S(T)> mapper) {
     UberSequence<S> *newSeq = new UberSequence<S>;
-    newSeq->size = this->size;
-    newSeq->numResponsibilities = this->numResponsibilities;
-    int totalBlocks = Cluster::blocksPerProc * Cluster::procs;
-    newSeq->responsibilities = new Responsibility[totalBlocks];
-    for (int block = 0; block < numResponsibilities; block++) {
-      newSeq->responsibilities[block].procId = this->responsibilities[block].procId;
-      newSeq->responsibilities[block].startIndex = this->responsibilities[block].startIndex;
-      newSeq->responsibilities[block].numElements = this->responsibilities[block].numElements;
+    newSeq->initializeLike(this);
+    SeqPart<T> *parts = this->mySeqParts;
+    newSeq->fillWith([parts, &mapper](int part, int i) { return mapper(parts[part].data[i]); });
+    return newSeq;
+  }
+
+  /** Returns a new sequence of zipper(a, b) for each element a of this sequence and the
+      element b at the same index of 'other', which must have the same length. If the two
+      aren't laid out alike, the one with the smaller elements is first copied to the
+      other's layout (with one MPI_Alltoallv), and the result is laid out like the other. **/
+  template<typename U, typename Zipper>
+  UberSequence<typename result_of<Zipper(T, U)>::type> *zipWith (UberSequence<U> *other,
+                                                                 Zipper zipper) {
+    typedef typename result_of<Zipper(T, U)>::type R;
+    assert(this->size == other->size);
+    if (!hasSameLayout(other)) {
+      UberSequence<R> *newSeq;
+      if (sizeof(U) <= sizeof(T)) {
+        UberSequence<U> *moved = other->repartitionLike(this);
+        newSeq = zipWith(moved, zipper);
+        delete moved;
+      } else {
+        UberSequence<T> *moved = repartitionLike(other);
+        newSeq = moved->zipWith(other, zipper);
+        delete moved;
+      }
+      return newSeq;
     }
-    newSeq->numParts = this->numParts;
-    newSeq->allocateSeqParts();
-    newSeq->numThreadBlocks = this->numThreadBlocks;
+
+    UberSequence<R> *newSeq = new UberSequence<R>;
+    newSeq->initializeLike(this);
+    SeqPart<T> *parts = this->mySeqParts;
+    SeqPart<U> *otherParts = other->mySeqParts;
+    newSeq->fillWith([parts, otherParts, &zipper](int part, int i) {
+      return zipper(parts[part].data[i], otherParts[part].data[i]);
+    });
+    return newSeq;
+  }
+
+  /** Returns a copy of this sequence laid out like 'layout' (see exchangeParts) **/
+  template<typename S>
+  UberSequence<T> *repartitionLike (UberSequence<S> *layout) {
+    assert(this->size == layout->size);
+    UberSequence<T> *newSeq = new UberSequence<T>;
+    newSeq->initializeLike(layout);
+    exchangeParts(this->responsibilities, this->numResponsibilities, this->mySeqParts,
+      newSeq->responsibilities, newSeq->numResponsibilities, newSeq->mySeqParts);
+    return newSeq;
+  }
+
+  /** Returns a view of elements [begin, end) of this sequence, without copying them. The
+      view's parts point into this sequence's parts (the blocks that overlap the range,
+      trimmed to it), so every operation runs on the range in place, and changes to the
+      elements through either sequence show in both. This sequence must outlive the view,
+      and isn't rebalanced while it has views. It can't be sorted while it has views
+      either, as that frees the parts they point into. Operations that move a view's data
+      (like sort) give it its own copy. Call it on every node, like the other operations. **/
+  UberSequence<T> *slice (int begin, int end) {
+    assert(0 <= begin && begin <= end && end <= this->size);
+    UberSequence<T> *view = new UberSequence<T>;
+    view->size = end - begin;
+    vector<Responsibility> blocks;
+    for (int block = 0; block < this->numResponsibilities; block++) {
+      Responsibility &responsibility = this->responsibilities[block];
+      int startIndex = max(responsibility.startIndex, begin);
+      int endIndex = min(responsibility.startIndex + responsibility.numElements, end);
+      if (startIndex < endIndex) {
+        Responsibility trimmed = { responsibility.procId, startIndex - begin,
+          endIndex - startIndex };
+        blocks.push_back(trimmed);
+      }
+    }
+    view->numResponsibilities = blocks.size();
+    view->responsibilities = Pool::newArray<Responsibility>(view->numResponsibilities);
+    copy(blocks.begin(), blocks.end(), view->responsibilities);
+
+    vector<SeqPart<T> > parts;
     for (int part = 0; part < this->numParts; part++) {
-      int numElements = this->mySeqParts[part].numElements;
-      for (int i = 0; i < numElements; i++) {
-        newSeq->mySeqParts[part].data[i] = mapper(this->mySeqParts[part].data[i]);
+      SeqPart<T> &seqPart = this->mySeqParts[part];
+      int startIndex = max(seqPart.startIndex, begin);
+      int endIndex = min(seqPart.startIndex + seqPart.numElements, end);
+      if (startIndex < endIndex) {
+        SeqPart<T> trimmed = { startIndex - begin, endIndex - startIndex,
+          seqPart.data + (startIndex - seqPart.startIndex) };
+        parts.push_back(trimmed);
+      }
+    }
+    view->setMySeqParts(parts);
+    view->viewed = this->viewed != NULL ? this->viewed : this;
+    view->viewed->numViews++;
+    return view;
+  }
+
+  /** Returns a new sequence of the elements for which predicate(element) is true, in
+      order. Each node compacts its own parts, and the survivor counts of the blocks give
+      the new layout, which drops the blocks left empty. If 'balance' is set and the
+      survivors are spread unevenly over the nodes, they are moved to the layout a new
+      sequence of their size would get. **/
+  template<typename Predicate>
+  UberSequence<T> *filter (Predicate predicate, bool balance = true) {
+    SeqPart<T> *parts = this->mySeqParts;
+    return filterWith<T>([parts, &predicate](int part, int i) {
+      return predicate(parts[part].data[i]);
+    }, PartLoader<T>(parts), balance);
+  }
+
+  /** Like filter, but keeps loader(part, i) for the elements where keep(part, i) is true **/
+  template<typename R, typename Keep, typename Loader>
+  UberSequence<R> *filterWith (Keep keep, Loader loader, bool balance = true) {
+    // Mark and count the survivors of each tile
+    int *partOffsets = getPartOffsets();
+    vector<Kernels::Tile> &tiles = getTiles();
+    int numTiles = tiles.size();
+    char *kept = Pool::allocateArray<char>(partOffsets[this->numParts]);
+    int *tileOffsets = Pool::newArray<int>(numTiles);
+    Scheduler::parallelFor(numTiles, 1, [&](int begin, int end) {
+      for (int t = begin; t < end; t++) {
+        Kernels::Tile &tile = tiles[t];
+        char *tileKept = kept + partOffsets[tile.part];
+        int count = 0;
+        for (int i = tile.begin; i < tile.end; i++) {
+          tileKept[i] = keep(tile.part, i) ? 1 : 0;
+          count += tileKept[i];
+        }
+        tileOffsets[t] = count;
+      }
+    });
+
+    // Survivors before each tile in its part, and in each of my parts
+    int *partCounts = Pool::newArray<int>(this->numParts);
+    int *zeros = Pool::newArray<int>(this->numParts);
+    Kernels::getPartReduces(tiles, tileOffsets, Sum(), partCounts);
+    Kernels::makeTileInits(tiles, tileOffsets, Sum(), zeros);
+
+    // Every node lays out the result from the survivor counts of all the blocks
+    int *blockCounts = getPartialReduces(partCounts);
+    int numBlocks = 0;
+    for (int block = 0; block < this->numResponsibilities; block++) {
+      numBlocks += blockCounts[block] > 0;
+    }
+    UberSequence<R> *newSeq = new UberSequence<R>;
+    newSeq->numResponsibilities = numBlocks;
+    newSeq->responsibilities = Pool::newArray<Responsibility>(numBlocks);
+    int size = 0;
+    for (int block = 0, newBlock = 0; block < this->numResponsibilities; block++) {
+      if (blockCounts[block] > 0) {
+        newSeq->responsibilities[newBlock].procId = this->responsibilities[block].procId;
+        newSeq->responsibilities[newBlock].startIndex = size;
+        newSeq->responsibilities[newBlock].numElements = blockCounts[block];
+        size += blockCounts[block];
+        newBlock++;
       }
     }
-    endMethod();
+    newSeq->size = size;
+    newSeq->allocateSeqParts();
+
+    // Copy the survivors, tile by tile
+    int *newPartOf = Pool::newArray<int>(this->numParts);
+    for (int part = 0, newPart = 0; part < this->numParts; part++) {
+      newPartOf[part] = partCounts[part] > 0 ? newPart++ : -1;
+    }
+    SeqPart<R> *newParts = newSeq->mySeqParts;
+    Scheduler::parallelFor(numTiles, 1, [&](int begin, int end) {
+      for (int t = begin; t < end; t++) {
+        Kernels::Tile &tile = tiles[t];
+        char *tileKept = kept + partOffsets[tile.part];
+        R *out = newPartOf[tile.part] >= 0 ?
+          newParts[newPartOf[tile.part]].data + tileOffsets[t] : NULL;
+        for (int i = tile.begin; i < tile.end; i++) {
+          if (tileKept[i]) {
+            *out++ = loader(tile.part, i);
+          }
+        }
+      }
+    });
+
+    Pool::deleteArray(kept, partOffsets[this->numParts]);
+    Pool::deleteArray(tileOffsets, numTiles);
+    Pool::deleteArray(partCounts, this->numParts);
+    Pool::deleteArray(zeros, this->numParts);
+    Pool::deleteArray(blockCounts, this->numResponsibilities);
+    Pool::deleteArray(newPartOf, this->numParts);
+    if (balance) {
+      newSeq->balanceLayout();
+    }
     return newSeq;
   }
 
-  void transform (function<T(T)> mapper) {
-    for (int part = 0; part < this->numParts; part++) {
-      int numElements = this->mySeqParts[part].numElements;
-      #pragma omp parallel for
-      for (int i = 0; i < numElements; i++) {
-        this->mySeqParts[part].data[i] = mapper(this->mySeqParts[part].data[i]);
+  /** Sorts the sequence by comparator (a strict weak order, as for std::sort) with a sample
+      sort. Each node sorts its elements with all its threads, and splitters are picked
+      from a sample of every node's elements. One MPI_Alltoallv sends node p the elements
+      between splitters p - 1 and p, which it merges. Afterwards each node holds one block,
+      in rank order, and the data is moved to a fresh layout if the buckets came out uneven
+      (see balanceLayout). Not allowed on a sequence with views (see slice). **/
+  template<typename Comparator>
+  void sort (Comparator comparator) {
+    assert(this->numViews == 0);
+    int procs = Cluster::procs;
+    int *partOffsets = getPartOffsets();
+    int myElements = partOffsets[this->numParts];
+
+    // Sort my elements
+    T *mine = Pool::allocateArray<T>(myElements);
+    T *scratch = Pool::allocateArray<T>(myElements);
+    SeqPart<T> *parts = this->mySeqParts;
+    Kernels::forEachElement(this->numParts, partOffsets, [&](int part, int i) {
+      mine[partOffsets[part] + i] = parts[part].data[i];
+    });
+    T *sorted = Kernels::sort(mine, scratch, myElements, comparator);
+
+    // Cut them at the splitters, and send each node its bucket
+    vector<T> splitters = chooseSplitters(sorted, myElements, comparator);
+    int *sendcounts = Pool::newArray<int>(procs);
+    int *recvcounts = Pool::newArray<int>(procs);
+    int bucketBegin = 0;
+    for (int procId = 0; procId < procs; procId++) {
+      int bucketEnd = procId < (int)splitters.size() ?
+        lower_bound(sorted, sorted + myElements, splitters[procId], comparator) - sorted :
+        myElements;
+      sendcounts[procId] = bucketEnd - bucketBegin;
+      bucketBegin = bucketEnd;
+    }
+    Exchange::exchangeCounts(sendcounts, recvcounts);
+    vector<int> runOffsets(procs + 1);
+    int received = Exchange::getDispls(recvcounts, &runOffsets[0]);
+    runOffsets[procs] = received;
+
+    // The bucket becomes my sequence part, so whichever buffer the merge leaves it in is
+    // first touched by the threads that will use it
+    T *bucket = allocatePartData(received);
+    constructPartData(bucket, received);
+    Exchange::alltoallv(sorted, sendcounts, recvcounts, bucket);
+    T *bucketScratch = Pool::allocateArray<T>(received);
+
+    // Each node sent a sorted run, so merge them
+    T *merged = Kernels::mergeRuns(bucket, bucketScratch, runOffsets, comparator);
+
+    // Node p now holds the elements of bucket p, as one block
+    Pool::deleteArray(merged == bucket ? bucketScratch : bucket, received);
+    destroy();
+    takeNodeBlock(merged, received);
+
+    // Clean up
+    Pool::deleteArray(mine, myElements);
+    Pool::deleteArray(scratch, myElements);
+    Pool::deleteArray(sendcounts, procs);
+    Pool::deleteArray(recvcounts, procs);
+    balanceLayout();
+  }
+
+  /** Lays the sequence out as one block per node, in rank order, made of each node's
+      'data' (numElements long, from the pool), which becomes its only sequence part.
+      Nodes with no elements hold no block. The sequence must hold no data already. **/
+  void takeNodeBlock (T *data, int numElements) {
+    int procs = Cluster::procs;
+    int *blockSizes = Pool::newArray<int>(procs);
+    MPI_Allgather(&numElements, 1, MPI_INT, blockSizes, 1, MPI_INT, MPI_COMM_WORLD);
+    int numBlocks = 0;
+    for (int procId = 0; procId < procs; procId++) {
+      numBlocks += blockSizes[procId] > 0;
+    }
+    this->responsibilities = Pool::newArray<Responsibility>(numBlocks);
+    this->numResponsibilities = numBlocks;
+    int startIndex = 0;
+    for (int procId = 0, block = 0; procId < procs; procId++) {
+      if (blockSizes[procId] > 0) {
+        this->responsibilities[block].procId = procId;
+        this->responsibilities[block].startIndex = startIndex;
+        this->responsibilities[block].numElements = blockSizes[procId];
+        if (procId == Cluster::procId) {
+          this->mySeqParts = Pool::newArray<SeqPart<T> >(1);
+          this->mySeqParts[0].startIndex = startIndex;
+          this->mySeqParts[0].numElements = numElements;
+          this->mySeqParts[0].data = data;
+        }
+        startIndex += blockSizes[procId];
+        block++;
       }
     }
-    endMethod();
+    this->size = startIndex;
+    this->numParts = numElements > 0 ? 1 : 0;
+    if (numElements == 0) {
+      this->mySeqParts = Pool::newArray<SeqPart<T> >(0);
+      Pool::deleteArray(data, numElements);
+    }
+    Pool::deleteArray(blockSizes, procs);
   }
 
-  T reduce (function<T(T,T)> combiner, T init) {
-    T *myPartialReduces = new T[this->numParts];
-    for (int part = 0; part < this->numParts; part++) {
-      T *seqPartialReduces = getSeqPartialReduces(&(this->mySeqParts[part]), combiner);
-      myPartialReduces[part] = getSeqReduce(&(this->mySeqParts[part]), seqPartialReduces, combiner);
-      delete[] seqPartialReduces;
+  /** Picks Cluster::procs - 1 splitters for sort from a sample of every node's sorted
+      elements. Nodes sample in proportion to their number of elements, so the splitters
+      cut the whole sequence (rather than each node's share of it) into even buckets. **/
+  template<typename Comparator>
+  vector<T> chooseSplitters (T *sorted, int n, Comparator &comparator) {
+    int procs = Cluster::procs;
+    int numSamples = 0;
+    if (this->size > 0) {
+      long long wanted = (long long)SORT_SAMPLES_PER_PROC * procs * n;
+      numSamples = min((long long)n, (wanted + this->size - 1) / this->size);
+    }
+    T *mySamples = Pool::newArray<T>(numSamples);
+    for (int sample = 0; sample < numSamples; sample++) {
+      mySamples[sample] = sorted[(2LL * sample + 1) * n / (2 * numSamples)];
     }
 
-    T *partialReduces = getPartialReduces(myPartialReduces);
+    int *recvcounts = Pool::newArray<int>(procs);
+    T *samples = Exchange::allgatherv(mySamples, numSamples, recvcounts);
+    int totalSamples = 0;
+    for (int procId = 0; procId < procs; procId++) {
+      totalSamples += recvcounts[procId];
+    }
+    std::sort(samples, samples + totalSamples, comparator);
 
-    // Compute the final answer
-    T value = init;
-    for (int i = 0; i < Cluster::procs * Cluster::blocksPerProc; i++) {
-      value = combiner(value, partialReduces[i]);
+    vector<T> splitters;
+    for (int procId = 1; procId < procs && totalSamples > 0; procId++) {
+      splitters.push_back(samples[(long long)procId * totalSamples / procs]);
     }
+    Pool::deleteArray(mySamples, numSamples);
+    Pool::deleteArray(recvcounts, procs);
+    Pool::deleteArray(samples, totalSamples);
+    return splitters;
+  }
 
-    delete[] myPartialReduces;
-    delete[] partialReduces;
-    endMethod();
-    return value;
+  /** Combines valueFn(x) over the elements x with equal keyFn(x), and returns a sequence
+      of (key, combined value) pairs, one per distinct key, in no particular order. E.g.
+      a histogram is seq.reduceByKey(bucketOf, [](int x) { return 1; }, Sum()). Each
+      thread combines its elements into its own KeyTable, the partials go to the node
+      that owns their key (by hash) with one MPI_Alltoallv, and that node combines them.
+      Keys and values are sent as bytes, like elements. **/
+  template<typename KeyFn, typename ValueFn, typename Combiner>
+  UberSequence<pair<typename decay<typename result_of<KeyFn(T)>::type>::type,
+                    typename decay<typename result_of<ValueFn(T)>::type>::type> > *
+  reduceByKey (KeyFn keyFn, ValueFn valueFn, Combiner combiner) {
+    static_assert(CombinerTraits<Combiner>::commutative,
+      "reduceByKey combines values in any order, so the combiner must be commutative "
+      "(e.g. wrap it with commutative())");
+    typedef typename decay<typename result_of<KeyFn(T)>::type>::type K;
+    typedef typename decay<typename result_of<ValueFn(T)>::type>::type V;
+    typedef pair<K, V> Entry;
+    int procs = Cluster::procs;
+
+    // Combine my elements, into a table per thread
+    int numThreads = omp_get_max_threads();
+    KeyTable<K, V> *threadTables = Pool::newArray<KeyTable<K, V> >(numThreads);
+    SeqPart<T> *parts = this->mySeqParts;
+    forEachElement([&](int part, int i) {
+      const T &element = parts[part].data[i];
+      threadTables[omp_get_thread_num()].add(keyFn(element), valueFn(element), combiner);
+    });
+
+    // Pack each table's entries by the node that owns their key
+    int *entryOffsets = Pool::newArray<int>(numThreads * procs); // [thread * procs + procId]
+    Scheduler::parallelFor(numThreads, 1, [&](int begin, int end) {
+      for (int thread = begin; thread < end; thread++) {
+        threadTables[thread].forEach([&](const K &key, const V &value) {
+          entryOffsets[thread * procs + getKeyOwner(key)]++;
+        });
+      }
+    });
+    int *sendcounts = Pool::newArray<int>(procs);
+    int *recvcounts = Pool::newArray<int>(procs);
+    int numSent = 0;
+    for (int procId = 0; procId < procs; procId++) {
+      for (int thread = 0; thread < numThreads; thread++) {
+        int numEntries = entryOffsets[thread * procs + procId];
+        entryOffsets[thread * procs + procId] = numSent;
+        numSent += numEntries;
+        sendcounts[procId] += numEntries;
+      }
+    }
+    Entry *sendbuf = Pool::allocateArray<Entry>(numSent);
+    Scheduler::parallelFor(numThreads, 1, [&](int begin, int end) {
+      for (int thread = begin; thread < end; thread++) {
+        threadTables[thread].forEach([&](const K &key, const V &value) {
+          sendbuf[entryOffsets[thread * procs + getKeyOwner(key)]++] = Entry(key, value);
+        });
+      }
+    });
+    Pool::deleteArray(threadTables, numThreads);
+
+    // Send them, and combine the entries for my keys
+    Exchange::exchangeCounts(sendcounts, recvcounts);
+    Entry *recvbuf = Exchange::alltoallv(sendbuf, sendcounts, recvcounts);
+    int numReceived = 0;
+    for (int procId = 0; procId < procs; procId++) {
+      numReceived += recvcounts[procId];
+    }
+    KeyTable<K, V> table;
+    for (int i = 0; i < numReceived; i++) {
+      table.add(recvbuf[i].first, recvbuf[i].second, combiner);
+    }
+
+    // Each node's keys become one block of the result
+    Entry *entries = Pool::newArray<Entry>(table.size());
+    int numEntries = 0;
+    table.forEach([&](const K &key, const V &value) {
+      entries[numEntries++] = Entry(key, value);
+    });
+    UberSequence<Entry> *newSeq = new UberSequence<Entry>;
+    newSeq->takeNodeBlock(entries, numEntries);
+
+    // Clean up
+    Pool::deleteArray(entryOffsets, numThreads * procs);
+    Pool::deleteArray(sendbuf, numSent);
+    Pool::deleteArray(recvbuf, numReceived);
+    Pool::deleteArray(sendcounts, procs);
+    Pool::deleteArray(recvcounts, procs);
+    newSeq->balanceLayout();
+    return newSeq;
   }
 
-  void scan (function<T(T,T)> combiner, T init) {
-    T *myPartialReduces = new T[this->numParts];
-    T **seqPartialReduces = new T*[this->numParts];
-    for (int part = 0; part < this->numParts; part++) {
-      seqPartialReduces[part] = getSeqPartialReduces(&(this->mySeqParts[part]), combiner);
-      myPartialReduces[part] = getSeqReduce(&(this->mySeqParts[part]), seqPartialReduces[part], combiner);
-      makeSeqPartialScans(seqPartialReduces[part], combiner);
+  /** Same, with the elements themselves as the values **/
+  template<typename KeyFn, typename Combiner>
+  UberSequence<pair<typename decay<typename result_of<KeyFn(T)>::type>::type, T> > *
+  reduceByKey (KeyFn keyFn, Combiner combiner) {
+    return reduceByKey(keyFn, [](const T &element) { return element; }, combiner);
+  }
+
+  /** The node that combines key's values in reduceByKey **/
+  template<typename K>
+  static int getKeyOwner (const K &key) {
+    return hash<K>()(key) % Cluster::procs;
+  }
+
+  /** The std::function overloads below are kept for the Sequence interface; the templated
+      versions let the compiler inline cheap mappers/combiners into the per-part loops **/
+  void transform (function<T(T)> mapper) {
+    transform<function<T(T)> >(mapper);
+  }
+
+  template<typename Mapper>
+  void transform (Mapper mapper) {
+    SeqPart<T> *parts = this->mySeqParts;
+    forEachElement([parts, &mapper](int part, int i) {
+      parts[part].data[i] = mapper(parts[part].data[i]);
+    });
+  }
+
+  /** With DYNAMIC_BALANCING, each node first transforms its own parts, then claims parts
+      from other nodes that haven't started them yet, fetches them with MPI_Get and
+      transforms them. Claimed parts move to the node that claimed them. **/
+  template<typename Mapper>
+  void transform (Mapper mapper, Balancing balancing) {
+    // Views and viewed sequences can't move their parts, and one node has no one to balance with
+    if (balancing == STATIC_BALANCING || this->viewed != NULL || this->numViews > 0 ||
+        Cluster::procs == 1) {
+      transform(mapper);
+      return;
     }
 
-    T *partialReduces = getPartialReduces(myPartialReduces);
+    // Every node holds the index of the next of its parts that hasn't been claimed
+    int *nextPart;
+    MPI_Win counterWin;
+    MPI_Win_allocate(sizeof(int), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &nextPart,
+      &counterWin);
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, Cluster::procId, 0, counterWin);
+    *nextPart = 0;
+    MPI_Win_unlock(Cluster::procId, counterWin);
+    MPI_Barrier(MPI_COMM_WORLD); // No node may claim a part before the counters are set
 
-    // Get the combination of all values before values in current node
-    T scan = init;
-    int myBlocksScanned = 0;
-    for (int i = 0; i < Cluster::procs * Cluster::blocksPerProc; i++) {
-      // Check if the current block is mine, if so apply
-      if (this->responsibilities[i].procId == Cluster::procId) {
-        applySeqScans(&(this->mySeqParts[myBlocksScanned]), combiner, scan, 
-          seqPartialReduces[myBlocksScanned]);
-        myBlocksScanned++;
+    // Expose my parts so that other nodes can fetch the ones they claim
+    vector<vector<int> > procBlocks(Cluster::procs);
+    for (int i = 0; i < this->numResponsibilities; i++) {
+      procBlocks[this->responsibilities[i].procId].push_back(i);
+    }
+    vector<MPI_Win> &partWins = getPartWindows();
+    for (size_t part = 0; part < partWins.size(); part++) {
+      MPI_Win_lock_all(0, partWins[part]);
+    }
+
+    // Claim my own parts first, then go around the other nodes
+    vector<int> myBlocks;
+    vector<SeqPart<T> > newParts;
+    vector<bool> partStolen(this->numParts, true);
+    int one = 1;
+    int part;
+    MPI_Win_lock_all(0, counterWin);
+    for (int offset = 0; offset < Cluster::procs; offset++) {
+      int victim = (Cluster::procId + offset) % Cluster::procs;
+      while (true) {
+        MPI_Fetch_and_op(&one, &part, MPI_INT, victim, 0, MPI_SUM, counterWin);
+        MPI_Win_flush(victim, counterWin);
+        if (part >= (int)procBlocks[victim].size()) {
+          break;
+        }
+        int block = procBlocks[victim][part];
+        SeqPart<T> seqPart;
+        if (victim == Cluster::procId) {
+          seqPart = this->mySeqParts[part];
+          partStolen[part] = false;
+        } else {
+          seqPart.startIndex = this->responsibilities[block].startIndex;
+          seqPart.numElements = this->responsibilities[block].numElements;
+          seqPart.data = allocatePartData(seqPart.numElements);
+          constructPartData(seqPart.data, seqPart.numElements);
+          MPI_Get(seqPart.data, seqPart.numElements * sizeof(T), MPI_BYTE, victim,
+            0, seqPart.numElements * sizeof(T), MPI_BYTE, partWins[part]);
+          MPI_Win_flush(victim, partWins[part]);
+        }
+        T *data = seqPart.data;
+        Scheduler::parallelFor(seqPart.numElements, [&](int begin, int end) {
+          for (int i = begin; i < end; i++) {
+            data[i] = mapper(data[i]);
+          }
+        });
+        myBlocks.push_back(block);
+        newParts.push_back(seqPart);
       }
-      scan = combiner(scan, partialReduces[i]);
     }
+    MPI_Win_unlock_all(counterWin);
+    MPI_Win_free(&counterWin);
+    for (size_t part = 0; part < partWins.size(); part++) {
+      MPI_Win_unlock_all(partWins[part]);
+    }
+
+    // Every node has finished fetching, so stolen parts can go
+    clearPartScratch();
+    updateOwners(myBlocks);
+    for (int part = 0; part < this->numParts; part++) {
+      if (partStolen[part]) {
+        freePartData(this->mySeqParts[part].data, this->mySeqParts[part].numElements);
+      }
+    }
+    Pool::deleteArray(this->mySeqParts, this->numParts);
+    setMySeqParts(newParts);
+  }
+
+  T reduce (function<T(T,T)> combiner, T init) {
+    return reduce<function<T(T,T)> >(combiner, init);
+  }
+
+  template<typename Combiner>
+  T reduce (Combiner combiner, T init) {
+    T value = reduceWith(PartLoader<T>(this->mySeqParts), combiner, init);
+    countBalancedOp();
+    return value;
+  }
+
+  void scan (function<T(T,T)> combiner, T init) {
+    scan<function<T(T,T)> >(combiner, init);
+  }
+
+  template<typename Combiner>
+  void scan (Combiner combiner, T init) {
+    scanWith(PartLoader<T>(this->mySeqParts), PartStorer<T>(this->mySeqParts), combiner, init);
+    countBalancedOp();
+  }
+
+  /** Reduces with several combiners in one pass and one collective, e.g.
+      seq.reduce(make_tuple(Min(), Max(), Sum()), make_tuple(intMax, intMin, 0))
+      returns the lowest element, the highest element and the sum as a tuple. **/
+  template<typename... Combiners, typename... Rs>
+  tuple<Rs...> reduce (tuple<Combiners...> combiners, tuple<Rs...> inits) {
+    static_assert(sizeof...(Combiners) == sizeof...(Rs), "one init per combiner");
+    tuple<Rs...> values = reduceWith(TupleLoader<PartLoader<T>, Rs...>(this->mySeqParts),
+      TupleCombiner<Combiners...>(combiners), inits);
+    countBalancedOp();
+    return values;
+  }
+
+  /** Scans like scan(combiner, init), and reduces the scanned elements with 'reducers' as
+      they are written, e.g. seq.scanAndReduce(Sum(), 0, make_tuple(Min(), Last()),
+      make_tuple(intMax, 0)) makes seq its prefix sums, and returns the lowest and the
+      last of them. The reduces take no extra pass, and share one collective. **/
+  template<typename Combiner, typename... Reducers, typename... Rs>
+  tuple<Rs...> scanAndReduce (Combiner combiner, T init, tuple<Reducers...> reducers,
+                              tuple<Rs...> reduceInits) {
+    static_assert(sizeof...(Reducers) == sizeof...(Rs), "one init per reducer");
+    typedef TupleLoader<PartLoader<T>, Rs...> Loader;
+    typedef TupleCombiner<Reducers...> Reducer;
+    Kernels::TileReducer<tuple<Rs...>, Loader, Reducer> hook(Loader(this->mySeqParts),
+      Reducer(reducers));
+    scanWith(PartLoader<T>(this->mySeqParts), PartStorer<T>(this->mySeqParts), combiner, init,
+      hook);
+    tuple<Rs...> values = combineTileReduces(*hook.tiles, hook.tileReduces, hook.combiner,
+      reduceInits);
+    Pool::deleteArray(hook.tileReduces, hook.tiles->size());
+    countBalancedOp();
+    return values;
+  }
 
-    delete[] myPartialReduces;
-    delete[] partialReduces;
+  /** Scans each segment of the sequence separately, starting from init. A segment starts
+      at index 0 and at every index where 'flags' (a sequence of the same length, e.g. of
+      bool) is true, so e.g. with + the elements (1, 2, 3, 4) and flags (0, 0, 1, 0) become
+      (1, 3, 3, 7). All the segments are scanned at once, as one scan of (flag, value)
+      pairs, so a segment can cross blocks and nodes. **/
+  template<typename F, typename Combiner>
+  void segmentedScan (UberSequence<F> *flags, Combiner combiner, T init) {
+    segmentedScanInto(flags, combiner, init, this->mySeqParts);
+    countBalancedOp();
+  }
+
+  /** Returns a sequence with init combined with the elements of each segment (see
+      segmentedScan), one per segment, in order **/
+  template<typename F, typename Combiner>
+  UberSequence<T> *segmentedReduce (UberSequence<F> *flags, Combiner combiner, T init) {
+    UberSequence<F> *moved = hasSameLayout(flags) ? NULL : flags->repartitionLike(this);
+    UberSequence<F> *myFlags = moved != NULL ? moved : flags;
+    UberSequence<T> scanned;
+    scanned.initializeLike(this);
+    segmentedScanInto(myFlags, combiner, init, scanned.mySeqParts);
+
+    // A segment's reduce is its last scanned element, so get the flag after each part
+    int *nextIndices = Pool::newArray<int>(this->numParts);
+    F *nextFlags = Pool::newArray<F>(this->numParts);
+    int numNext = 0;
     for (int part = 0; part < this->numParts; part++) {
-      delete[] seqPartialReduces[part];
+      int nextIndex = this->mySeqParts[part].startIndex + this->mySeqParts[part].numElements;
+      if (nextIndex < this->size) {
+        nextIndices[numNext++] = nextIndex;
+      }
     }
-    delete[] seqPartialReduces;
-    endMethod();
+    myFlags->get(nextIndices, numNext, nextFlags);
+    if (numNext < this->numParts) {
+      nextFlags[numNext] = F(1); // The last element of the sequence ends a segment
+    }
+
+    SeqPart<F> *flagParts = myFlags->mySeqParts;
+    UberSequence<T> *reduces = scanned.template filterWith<T>(
+      [flagParts, nextFlags](int part, int i) {
+        return i + 1 < flagParts[part].numElements ? bool(flagParts[part].data[i + 1]) :
+          bool(nextFlags[part]);
+      }, PartLoader<T>(scanned.mySeqParts));
+
+    Pool::deleteArray(nextIndices, this->numParts);
+    Pool::deleteArray(nextFlags, this->numParts);
+    delete moved;
+    countBalancedOp();
+    return reduces;
+  }
+
+  /** Segmented scan of my elements (see segmentedScan) into outParts, which must have my
+      layout. flags is copied to my layout first if it has a different one. **/
+  template<typename F, typename Combiner>
+  void segmentedScanInto (UberSequence<F> *flags, Combiner combiner, T init,
+                          SeqPart<T> *outParts) {
+    UberSequence<F> *moved = hasSameLayout(flags) ? NULL : flags->repartitionLike(this);
+    SeqPart<F> *flagParts = (moved != NULL ? moved : flags)->mySeqParts;
+    SeqPart<T> *parts = this->mySeqParts;
+    typedef pair<bool, T> Entry;
+
+    // The first element of each segment carries init, as does the scan's init
+    scanWith([parts, flagParts, &combiner, &init](int part, int i) {
+      bool start = bool(flagParts[part].data[i]);
+      return Entry(start, start ? combiner(init, parts[part].data[i]) : parts[part].data[i]);
+    }, [outParts](int part, int i, const Entry &scan) {
+      outParts[part].data[i] = scan.second;
+    }, Segmented<Combiner>(combiner), Entry(true, init));
+    delete moved;
+  }
+
+  /** Asynchronous versions of reduce and scan (see reduceWithAsync and scanWithAsync).
+      They don't count towards balance checks, since a rebalance could move data that an
+      operation in flight still uses. **/
+  template<typename Combiner>
+  Future<T> reduceAsync (Combiner combiner, T init) {
+    return reduceWithAsync(PartLoader<T>(this->mySeqParts), combiner, init);
+  }
+
+  template<typename Combiner>
+  Future<void> scanAsync (Combiner combiner, T init) {
+    return scanWithAsync(PartLoader<T>(this->mySeqParts), PartStorer<T>(this->mySeqParts),
+      combiner, init);
   }
 
   T get (int index) {
@@ -485,8 +2115,225 @@ public:
     return value;
   }
 
+  /** Gets the elements at indices[0..n) into values. Every node calls this at the same time,
+      but with its own indices. Requests are grouped by the node that holds them, and all
+      nodes exchange them at once, rather than broadcasting each element. **/
+  void get (int *indices, int n, T *values) {
+    // Group my indices by the node that has them
+    int procs = Cluster::procs;
+    int *owners = Pool::allocateArray<int>(n);
+    int *sendcounts = Pool::newArray<int>(procs);
+    int *sdispls = Pool::newArray<int>(procs);
+    int *recvcounts = Pool::newArray<int>(procs);
+    for (int i = 0; i < n; i++) {
+      owners[i] = getNodeWithData(indices[i]);
+      sendcounts[owners[i]]++;
+    }
+    Exchange::getDispls(sendcounts, sdispls);
+    int *sendIndices = Pool::allocateArray<int>(n);
+    int *order = Pool::allocateArray<int>(n); // Where each of my requests goes in sendIndices
+    for (int i = 0; i < n; i++) {
+      order[i] = sdispls[owners[i]]++;
+      sendIndices[order[i]] = indices[i];
+    }
+
+    // Send the indices to their nodes, which look them up and send back the elements
+    Exchange::exchangeCounts(sendcounts, recvcounts);
+    int *requests = Exchange::alltoallv(sendIndices, sendcounts, recvcounts);
+    int numRequests = 0;
+    for (int procId = 0; procId < procs; procId++) {
+      numRequests += recvcounts[procId];
+    }
+    T *replies = Pool::allocateArray<T>(numRequests);
+    Scheduler::parallelFor(numRequests, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        replies[i] = getData(requests[i]);
+      }
+    });
+    T *received = Exchange::alltoallv(replies, recvcounts, sendcounts);
+    for (int i = 0; i < n; i++) {
+      values[i] = received[order[i]];
+    }
+
+    // Clean up
+    Pool::deleteArray(owners, n);
+    Pool::deleteArray(sendcounts, procs);
+    Pool::deleteArray(sdispls, procs);
+    Pool::deleteArray(recvcounts, procs);
+    Pool::deleteArray(sendIndices, n);
+    Pool::deleteArray(order, n);
+    Pool::deleteArray(requests, numRequests);
+    Pool::deleteArray(replies, numRequests);
+    Pool::deleteArray(received, n);
+  }
+
+  /** Starts broadcasting the element at 'index' from the node that has it **/
+  Future<T> getAsync (int index) {
+    int nodeWithIndex = getNodeWithData(index);
+    T *value = Pool::newArray<T>(1);
+    if (Cluster::procId == nodeWithIndex) {
+      *value = getData(index);
+    }
+    MPI_Request request;
+    MPI_Ibcast(value, sizeof(T), MPI_BYTE, nodeWithIndex, MPI_COMM_WORLD, &request);
+    return Future<T>(request, [value]() {
+      T result = *value;
+      Pool::deleteArray(value, 1);
+      return result;
+    });
+  }
+
+  /** Like get, every node calls this with the same index and value **/
   void set (int index, T value) {
+    if (Cluster::procId == getNodeWithData(index)) {
+      SeqPart<T> *part = upper_bound(this->mySeqParts, this->mySeqParts + this->numParts, index,
+        [](int index, const SeqPart<T> &part) { return index < part.startIndex; }) - 1;
+      part->data[index - part->startIndex] = value;
+    }
+  }
+
+  /** Sets element indices[i] to values[i] for i in [0, n). Every node calls this at the same
+      time, but with its own updates. Each node's updates are grouped by the node that
+      holds their elements and sent in one MPI_Alltoallv, and each node applies the ones
+      it gets. If several updates set the same index, the last one from the highest node
+      is kept. **/
+  void scatter (int *indices, T *values, int n) {
+    scatterWith(indices, values, n, [](const T &a, const T &b) { return b; });
+  }
+
+  /** Like scatter, but combines each value into its element. E.g. a histogram is
+      scatter(bins, ones, n, Sum()). Updates to the same index from any nodes are all
+      combined in, in order of node, then of their order in indices. **/
+  template<typename Combiner>
+  void scatter (int *indices, T *values, int n, Combiner combiner) {
+    scatterWith(indices, values, n, combiner);
+  }
+
+  /** Sorts and merges my updates, sends each node the ones for its elements, and sets each
+      element I get updates for to merge(element, value) for each of them in order **/
+  template<typename Merge>
+  void scatterWith (int *indices, T *values, int n, Merge merge) {
+    typedef pair<int, T> Update;
+    int procs = Cluster::procs;
+
+    // Sort my updates by index, merging the updates to each index in order
+    int *order = Pool::allocateArray<int>(n);
+    for (int i = 0; i < n; i++) {
+      order[i] = i;
+    }
+    stable_sort(order, order + n, [indices](int a, int b) { return indices[a] < indices[b]; });
+    Update *updates = Pool::newArray<Update>(n);
+    int numUpdates = 0;
+    for (int i = 0; i < n; i++) {
+      if (numUpdates > 0 && updates[numUpdates - 1].first == indices[order[i]]) {
+        updates[numUpdates - 1].second = merge(updates[numUpdates - 1].second,
+          values[order[i]]);
+      } else {
+        updates[numUpdates++] = Update(indices[order[i]], values[order[i]]);
+      }
+    }
+
+    // Group them by the node that has their element, keeping them in order of index
+    int *owners = Pool::allocateArray<int>(numUpdates);
+    int *sendcounts = Pool::newArray<int>(procs);
+    int *sdispls = Pool::newArray<int>(procs);
+    int *recvcounts = Pool::newArray<int>(procs);
+    for (int i = 0; i < numUpdates; i++) {
+      owners[i] = getNodeWithData(updates[i].first);
+      sendcounts[owners[i]]++;
+    }
+    Exchange::getDispls(sendcounts, sdispls);
+    Update *sendbuf = Pool::allocateArray<Update>(numUpdates);
+    for (int i = 0; i < numUpdates; i++) {
+      sendbuf[sdispls[owners[i]]++] = updates[i];
+    }
+    Exchange::exchangeCounts(sendcounts, recvcounts);
+    Update *received = Exchange::alltoallv(sendbuf, sendcounts, recvcounts);
+    int numReceived = 0;
+    for (int procId = 0; procId < procs; procId++) {
+      numReceived += recvcounts[procId];
+    }
 
+    // Apply them in order of index, and of node for each index
+    stable_sort(received, received + numReceived, [](const Update &a, const Update &b) {
+      return a.first < b.first;
+    });
+    int part = 0;
+    for (int i = 0; i < numReceived; i++) {
+      int index = received[i].first;
+      while (index >= this->mySeqParts[part].startIndex + this->mySeqParts[part].numElements) {
+        part++;
+      }
+      T &element = this->mySeqParts[part].data[index - this->mySeqParts[part].startIndex];
+      element = merge(element, received[i].second);
+    }
+
+    // Clean up
+    Pool::deleteArray(order, n);
+    Pool::deleteArray(updates, n);
+    Pool::deleteArray(owners, numUpdates);
+    Pool::deleteArray(sendcounts, procs);
+    Pool::deleteArray(sdispls, procs);
+    Pool::deleteArray(recvcounts, procs);
+    Pool::deleteArray(sendbuf, numUpdates);
+    Pool::deleteArray(received, numReceived);
+  }
+
+  /** Copies the whole sequence into 'array' (of length() elements) on node 'root'. The
+      other nodes may pass NULL. Like the scatter constructor, it moves the elements with
+      MPI_Igatherv in chunks of about ROOT_CHUNK_BYTES, packing the next chunk while the
+      last one is on its way. **/
+  void gather (T *array, int root) {
+    int n = this->size;
+    int procs = Cluster::procs;
+    int chunkElements = max(1, ROOT_CHUNK_BYTES / (int)sizeof(T));
+    int numChunks = (n + chunkElements - 1) / chunkElements;
+    bool isRoot = Cluster::procId == root;
+    T *sendbufs[2];
+    T *recvbufs[2];
+    int *recvcounts[2]; // Note, this is in BYTES
+    int *displs[2]; // Note, this is in BYTES
+    MPI_Request requests[2];
+    for (int buffer = 0; buffer < 2; buffer++) {
+      sendbufs[buffer] = Pool::allocateArray<T>(chunkElements);
+      recvbufs[buffer] = Pool::allocateArray<T>(isRoot ? chunkElements : 0);
+      recvcounts[buffer] = Pool::newArray<int>(procs);
+      displs[buffer] = Pool::newArray<int>(procs);
+    }
+
+    // Chunk c is gathered into buffer c % 2, and unpacked into array after chunk c + 1 is sent
+    int sent = 0;
+    for (int chunk = 0; chunk <= numChunks; chunk++) {
+      int buffer = chunk % 2;
+      if (chunk < numChunks) {
+        int chunkStart = chunk * chunkElements;
+        int chunkEnd = min(n, chunkStart + chunkElements);
+        getChunkCounts(chunkStart, chunkEnd, recvcounts[buffer], displs[buffer]);
+        int count = recvcounts[buffer][Cluster::procId] / sizeof(T);
+        copyMyElements(sent, count, sendbufs[buffer], true);
+        sent += count;
+        MPI_Igatherv(sendbufs[buffer], count * sizeof(T), MPI_BYTE, recvbufs[buffer],
+          recvcounts[buffer], displs[buffer], MPI_BYTE, root, MPI_COMM_WORLD,
+          &requests[buffer]);
+      }
+      if (chunk > 0) {
+        int last = 1 - buffer;
+        MPI_Wait(&requests[last], MPI_STATUS_IGNORE);
+        if (isRoot) {
+          int chunkStart = (chunk - 1) * chunkElements;
+          int chunkEnd = min(n, chunkStart + chunkElements);
+          packChunk(chunkStart, chunkEnd, array, recvbufs[last], displs[last], false);
+        }
+      }
+    }
+
+    // Clean up
+    for (int buffer = 0; buffer < 2; buffer++) {
+      Pool::deleteArray(sendbufs[buffer], chunkElements);
+      Pool::deleteArray(recvbufs[buffer], isRoot ? chunkElements : 0);
+      Pool::deleteArray(recvcounts[buffer], procs);
+      Pool::deleteArray(displs[buffer], procs);
+    }
   }
 
   /** For debugging purposes **/
@@ -507,7 +2354,6 @@ public:
     //   if (i % 10 != 0) cout << endl;
     // }
     // cout << endl;
-    endMethod();
   }
 
   /** For debugging purposes only **/